@@ -0,0 +1,292 @@
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <thread>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "Trace.hpp"
+
+#if defined(HAVE_LIBURING_H)
+#include <liburing.h>
+#endif
+
+// Positioned, asynchronous file output.
+// Write() queues a block for a given offset and returns at once, an I/O thread writes it out.
+// With io_uring several writes are in flight at the same time, otherwise the thread pwrite()s
+//  them in order. Write() only blocks once 'max_in_flight' writes are outstanding.
+// An I/O error is reported by the next Write() or Close().
+class AsyncWriter {
+
+	struct Block {
+		int64_t offset;
+		const char * data;
+		size_t size;
+		std::shared_ptr<const void> owner;	// keeps 'data' alive until it's written.
+	};
+
+	int fd {-1};
+	const int max_in_flight;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable readable;
+	std::condition_variable writable;
+
+	std::deque<Block *> queue;
+	int outstanding {0};	// queued + in flight
+	int64_t end {0};	// file size once everything is written.
+	bool quit {false};
+	bool error {false};
+
+	// a write has finished ( or failed ), free up its slot.
+	void Done(Block * block, bool ok) {
+
+		delete block;
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		if(!ok)
+			error = true;
+
+		--outstanding;
+		Trace::Instance().Counter("writes outstanding", outstanding);
+		writable.notify_all();
+	}
+
+	// next block to write, or NULL when closing. With 'wait' false, returns NULL if nothing is queued.
+	Block * Next(bool wait) {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		while( wait && queue.empty() && !quit )
+			readable.wait( lock );
+
+		if(queue.empty())
+			return NULL;
+
+		Block * block = queue.front();
+		queue.pop_front();
+		return block;
+	}
+
+	bool PWrite(const Block & block) {
+
+		Trace::Span span("pwrite", "write");
+
+		size_t done = 0;
+
+		while(done < block.size) {
+
+			const ssize_t n = pwrite(fd, block.data + done, block.size - done, (off_t)(block.offset + done));
+
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+
+			done += n;
+		}
+		return true;
+	}
+
+	void PWriteThread() {
+
+		Block * block;
+
+		while( (block = Next(true)) ) {
+			const bool ok = PWrite(*block);
+			Done(block, ok);
+		}
+	}
+
+#if defined(HAVE_LIBURING_H)
+	struct io_uring ring;
+	bool have_ring {false};
+
+	void Submit(Block * block) {
+
+		struct io_uring_sqe * sqe = io_uring_get_sqe(&ring);
+
+		io_uring_prep_write(sqe, fd, block->data, block->size, block->offset);
+		io_uring_sqe_set_data(sqe, block);
+		io_uring_submit(&ring);
+	}
+
+	void UringThread() {
+
+		int in_flight = 0;
+
+		for(;;) {
+
+			// fill the ring, only blocking for more work when nothing is in flight.
+			Block * block;
+			while( in_flight < max_in_flight && (block = Next(in_flight == 0)) ) {
+				Submit(block);
+				++in_flight;
+			}
+
+			if(in_flight == 0)
+				break;
+
+			struct io_uring_cqe * cqe;
+			if(io_uring_wait_cqe(&ring, &cqe) < 0)
+				continue;
+
+			block = static_cast<Block *>( io_uring_cqe_get_data(cqe) );
+			const int res = cqe->res;
+			io_uring_cqe_seen(&ring, cqe);
+			--in_flight;
+
+			if(res > 0 && (size_t)res < block->size) {
+				// short write, send the rest.
+				block->data += res;
+				block->offset += res;
+				block->size -= res;
+				Submit(block);
+				++in_flight;
+			}
+			else
+				Done(block, res > 0 || (res == 0 && block->size == 0)); // like pwrite, nothing written is an error.
+		}
+	}
+#endif
+
+	void Main() {
+
+		Trace::Instance().ThreadName("io");
+
+#if defined(HAVE_LIBURING_H)
+		if(have_ring) {
+			UringThread();
+			return;
+		}
+#endif
+		PWriteThread();
+	}
+
+public:
+
+	AsyncWriter(const char * fn, int max_in_flight = 8)
+		:	max_in_flight(max_in_flight)
+	{
+		if((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+			throw std::runtime_error("can't open output file!");
+
+#if defined(HAVE_LIBURING_H)
+		// fall back to pwrite if the kernel won't give us a ring.
+		have_ring = io_uring_queue_init(max_in_flight, &ring, 0) == 0;
+#endif
+
+		thread = std::thread( &AsyncWriter::Main, this );
+	}
+
+	AsyncWriter(const AsyncWriter &) = delete;
+
+	~AsyncWriter() {
+
+		Close();
+	}
+
+	// Ask the file system for 'size' bytes up front. Only a hint, the file size doesn't change,
+	//  and anything unused is released by 'Close'.
+	// File systems that can't reserve space are fine, any other failure ( like a full disk ) is an I/O error.
+	void Reserve(int64_t size) {
+
+#if defined(FALLOC_FL_KEEP_SIZE)
+		if(fd < 0 || size <= 0)
+			return;
+
+		int r;
+		while( (r = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size)) != 0 && errno == EINTR )
+			;
+
+		if(r != 0 && errno != EOPNOTSUPP) {
+			printf("ERROR: can't reserve %lld bytes of output, %s\n", (long long)size, strerror(errno));
+			std::unique_lock<std::mutex> lock( mutex );
+			error = true;
+		}
+#endif
+	}
+
+	void Write(int64_t offset, const void * data, size_t size, std::shared_ptr<const void> owner) {
+
+		Block * block = new Block;
+		block->offset = offset;
+		block->data = static_cast<const char *>(data);
+		block->size = size;
+		block->owner = owner;
+
+		Trace::Span span("wait for io", "wait");
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		while( outstanding >= max_in_flight && !error )
+			writable.wait( lock );
+
+		if(error) {
+			delete block;
+			throw std::runtime_error("Write error.");
+		}
+
+		end = std::max<int64_t>(end, offset + size);
+
+		++outstanding;
+		Trace::Instance().Counter("writes outstanding", outstanding);
+		queue.push_back(block);
+		readable.notify_one();
+	}
+
+	// Wait for everything queued to be written.
+	void Flush() {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		while( outstanding > 0 )
+			writable.wait( lock );
+
+		if(error)
+			throw std::runtime_error("Write error.");
+	}
+
+	// Write everything out and close the file. Returns false on any write error.
+	bool Close() {
+
+		if(fd < 0)
+			return !error;
+
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			quit = true;
+			readable.notify_all();
+		}
+
+		thread.join();
+
+#if defined(HAVE_LIBURING_H)
+		if(have_ring)
+			io_uring_queue_exit(&ring);
+#endif
+
+		// give back anything 'Reserve' over-estimated.
+		if(ftruncate(fd, (off_t)end) != 0)
+			error = true;
+
+		if(close(fd) != 0)
+			error = true;
+
+		fd = -1;
+
+		return !error;
+	}
+};
@@ -0,0 +1,212 @@
+
+#pragma once
+
+#include <knib_read.h>
+#include <stdexcept>
+#include <string.h>
+#include <vector>
+#include "lz4.h"
+#include "lz4hc.h"
+
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Compresses set data blocks as the files KNIB_DATA_MASK says, at a chosen level.
+// LZ4 level 0 is its fast mode, and 1 ( the default ) HC.
+// zstd takes its own levels, from 1 to ZSTD_maxCLevel(), and defaults to 9.
+// With KNIB_DATA_SHUFFLE, the halves of each texture block are split into two streams first.
+class Codec {
+
+	int data; // KNIB_DATA_PLAIN, KNIB_DATA_LZ4 or KNIB_DATA_ZSTD. ( 0 is plain )
+	int level;
+	bool shuffle;
+	double min_ratio; // see 'MinRatio'
+
+	int CompressBlock(const char * src, int size, char * dst) const {
+
+		switch(data) {
+		case KNIB_DATA_LZ4:
+			return level ? LZ4_compressHC(src, dst, size) : LZ4_compress(src, dst, size);
+#ifdef HAVE_ZSTD_H
+		case KNIB_DATA_ZSTD:
+		{
+			const size_t r = ZSTD_compress(dst, Bound(size), src, size, level);
+			if(ZSTD_isError(r))
+				throw std::runtime_error(ZSTD_getErrorName(r));
+			return r;
+		}
+#endif
+		default:
+			memcpy(dst, src, size);
+			return size;
+		}
+	}
+
+	bool DecompressBlock(const char * src, int src_size, char * dst, int size) const {
+
+		switch(data) {
+		case KNIB_DATA_LZ4:
+			return LZ4_uncompress(src, dst, size) == src_size;
+#ifdef HAVE_ZSTD_H
+		case KNIB_DATA_ZSTD:
+			return ZSTD_decompress(dst, size, src, src_size) == (size_t)size;
+#endif
+		default:
+			if(src_size != size)
+				return false;
+			memcpy(dst, src, size);
+			return true;
+		}
+	}
+
+public:
+
+	// 'data_flags' are masked with KNIB_DATA_MASK and KNIB_DATA_SHUFFLE, a negative 'level' is the codecs default.
+	Codec(int data_flags, int level = -1, double min_ratio = 0)
+		:	data(data_flags & KNIB_DATA_MASK),
+		 	level(level),
+		 	shuffle(!!(data_flags & KNIB_DATA_SHUFFLE)),
+		 	min_ratio(min_ratio)
+	{
+		if(shuffle && !Compressed())
+			throw std::runtime_error("--shuffle needs --LZ4 or --zstd!");
+
+		switch(data) {
+		case KNIB_DATA_LZ4:
+			if(level > 1)
+				throw std::runtime_error("LZ4 levels are 0 (fast) or 1 (HC)!");
+			if(level < 0)
+				this->level = 1;
+			break;
+		case KNIB_DATA_ZSTD:
+#ifdef HAVE_ZSTD_H
+			if(level > ZSTD_maxCLevel())
+				throw std::runtime_error("zstd level out of range!");
+			if(level <= 0)
+				this->level = 9;
+			break;
+#else
+			throw std::runtime_error("built without zstd!");
+#endif
+		default:
+			this->level = 0;
+			break;
+		}
+	}
+
+	// true if 'data_flags' compress set data, so readers need an uncompressed buffer.
+	static bool Compressed(int data_flags) {
+
+		return (data_flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4 || (data_flags & KNIB_DATA_MASK) == KNIB_DATA_ZSTD;
+	}
+
+	bool Compressed() const { return Compressed(data); }
+
+	int Data() const { return data; }
+
+	int Level() const { return level; }
+
+	bool Shuffled() const { return shuffle; }
+
+	// Sets must compress at least this many times smaller than the next cheapest way to
+	//  decode them ( LZ4 for zstd, plain for LZ4 ), or are stored that way instead. 0 for never.
+	double MinRatio() const { return min_ratio; }
+
+	// the codec a set was stored with. ( sets may override the files compression, see KNIB_SET_DATA_MASK )
+	static Codec OfSet(int file_flags, int set_flags) {
+
+		const int set_data = (set_flags & KNIB_SET_DATA_MASK) ? (set_flags & KNIB_SET_DATA_MASK) : (file_flags & KNIB_DATA_MASK);
+
+		return Codec(set_data | (Compressed(set_data) ? (file_flags & KNIB_DATA_SHUFFLE) : 0));
+	}
+
+	const char * Name() const {
+
+		switch(data) {
+		case KNIB_DATA_LZ4: return level ? "LZ4HC" : "LZ4";
+		case KNIB_DATA_ZSTD: return "zstd";
+		default: return "plain";
+		}
+	}
+
+	// KNIB_DATA_SHUFFLE: the first 4 bytes of each 8 byte block ( DXT1 colours, ETC1 base colours and modes ),
+	//  then the last 4. ( their indices ) Trailing bytes that aren't a whole block stay where they are.
+	static void Shuffle(const char * src, int size, char * dst) {
+
+		const int blocks = size / 8;
+
+		for(int i=0; i<blocks; i++) {
+			memcpy(dst + i * 4, src + i * 8, 4);
+			memcpy(dst + (blocks + i) * 4, src + i * 8 + 4, 4);
+		}
+		memcpy(dst + blocks * 8, src + blocks * 8, size - blocks * 8);
+	}
+
+	// undoes 'Shuffle'.
+	static void Unshuffle(const char * src, int size, char * dst) {
+
+		const int blocks = size / 8;
+		int i = 0;
+
+#if defined(__SSE2__)
+		for(; i+4<=blocks; i+=4) {
+
+			const __m128i head = _mm_loadu_si128((const __m128i *)(src + i * 4));
+			const __m128i tail = _mm_loadu_si128((const __m128i *)(src + (blocks + i) * 4));
+
+			_mm_storeu_si128((__m128i *)(dst + i * 8), _mm_unpacklo_epi32(head, tail));
+			_mm_storeu_si128((__m128i *)(dst + i * 8 + 16), _mm_unpackhi_epi32(head, tail));
+		}
+#endif
+
+		for(; i<blocks; i++) {
+			memcpy(dst + i * 8, src + i * 4, 4);
+			memcpy(dst + i * 8 + 4, src + (blocks + i) * 4, 4);
+		}
+		memcpy(dst + blocks * 8, src + blocks * 8, size - blocks * 8);
+	}
+
+	// the most 'size' bytes can take, once compressed.
+	int Bound(int size) const {
+
+		switch(data) {
+		case KNIB_DATA_LZ4:
+			return LZ4_compressBound(size);
+#ifdef HAVE_ZSTD_H
+		case KNIB_DATA_ZSTD:
+			return ZSTD_compressBound(size);
+#endif
+		default:
+			return size;
+		}
+	}
+
+	// compresses 'size' bytes into 'dst', which holds at least 'Bound(size)' bytes. Returns the compressed size.
+	int Compress(const char * src, int size, char * dst) const {
+
+		if(!shuffle)
+			return CompressBlock(src, size, dst);
+
+		std::vector<char> shuffled(size);
+		Shuffle(src, size, &shuffled[0]);
+		return CompressBlock(&shuffled[0], size, dst);
+	}
+
+	// decompresses 'src_size' bytes into exactly 'size' bytes of 'dst'.
+	bool Decompress(const char * src, int src_size, char * dst, int size) const {
+
+		if(!shuffle)
+			return DecompressBlock(src, src_size, dst, size);
+
+		std::vector<char> shuffled(size);
+		if(!DecompressBlock(src, src_size, &shuffled[0], size))
+			return false;
+		Unshuffle(&shuffled[0], size, dst);
+		return true;
+	}
+};
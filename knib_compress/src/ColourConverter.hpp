@@ -0,0 +1,278 @@
+
+#pragma once
+
+#include <libimg.h>
+#include <stdint.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Image.hpp"
+
+// Converts an RGB(A) frame straight into one lane of the interleaved Y, Cb, Cr and A textures
+//  used by the planar work set, without an intermediate YUVA420P image.
+// Full range BT.601 in 8 bit fixed point, chroma is the average of each 2x2 quad.
+// The SSE2 version handles 8x2 pixels at a time and gives exactly the same result as the scalar code.
+class ColourConverter {
+
+	static int Clamp(int v) {
+
+		return v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+
+	static int Luma(int r, int g, int b) {
+
+		return (77*r + 150*g + 29*b + 128) >> 8;
+	}
+
+	// chroma from the sums of 4 pixels.
+	static int Cb(int r, int g, int b) {
+
+		return Clamp( (-43*r - 85*g + 128*b + 128*1024 + 512) >> 10 );
+	}
+
+	static int Cr(int r, int g, int b) {
+
+		return Clamp( (128*r - 107*g - 21*b + 128*1024 + 512) >> 10 );
+	}
+
+	// one 2x2 quad at (x,y), edge pixels are repeated for odd sizes.
+	static void Quad(const unsigned char * src, int pitch, int bpp, int w, int h, int x, int y,
+		unsigned char * dy, int dy_pitch, unsigned char * dcb, unsigned char * dcr, unsigned char * da, int lane)
+	{
+		int sr = 0, sg = 0, sb = 0;
+
+		for(int j=0;j<2;j++) {
+			for(int i=0;i<2;i++) {
+
+				const int sx = std::min(x+i, w-1);
+				const int sy = std::min(y+j, h-1);
+				const unsigned char * p = src + pitch * sy + bpp * sx;
+
+				sr += p[0];
+				sg += p[1];
+				sb += p[2];
+
+				if(x+i < w && y+j < h) {
+					dy[ dy_pitch * (y+j) + 4 * (x+i) + lane ] = Luma(p[0], p[1], p[2]);
+					if(da)
+						da[ dy_pitch * (y+j) + 4 * (x+i) + lane ] = bpp == 4 ? p[3] : 0xff;
+				}
+			}
+		}
+
+		*dcb = Cb(sr, sg, sb);
+		*dcr = Cr(sr, sg, sb);
+	}
+
+#if defined(__SSE2__)
+	// 4 RGBA pixels to 4 x 32 bit luma.
+	static __m128i Luma_SSE2(__m128i p) {
+
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i k = _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+
+		const __m128i lo = _mm_madd_epi16( _mm_unpacklo_epi8(p, zero), k );	// rg0 b0 rg1 b1
+		const __m128i hi = _mm_madd_epi16( _mm_unpackhi_epi8(p, zero), k );	// rg2 b2 rg3 b3
+
+		const __m128 e = _mm_shuffle_ps( _mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2,0,2,0) );
+		const __m128 o = _mm_shuffle_ps( _mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3,1,3,1) );
+
+		const __m128i y = _mm_add_epi32( _mm_castps_si128(e), _mm_castps_si128(o) );
+
+		return _mm_srli_epi32( _mm_add_epi32( y, _mm_set1_epi32(128) ), 8 );
+	}
+
+	// 4 quad sums (16 bit r,g,b,a each) to 4 x 32 bit chroma using coefficients k.
+	static __m128i Chroma_SSE2(__m128i lo, __m128i hi, __m128i k) {
+
+		const __m128i a = _mm_madd_epi16(lo, k);
+		const __m128i b = _mm_madd_epi16(hi, k);
+
+		const __m128 e = _mm_shuffle_ps( _mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2,0,2,0) );
+		const __m128 o = _mm_shuffle_ps( _mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3,1,3,1) );
+
+		const __m128i c = _mm_add_epi32( _mm_castps_si128(e), _mm_castps_si128(o) );
+		const __m128i v = _mm_srai_epi32( _mm_add_epi32( c, _mm_set1_epi32(128*1024 + 512) ), 10 );
+
+		// clamp to 0..255
+		const __m128i s = _mm_packus_epi16( _mm_packs_epi32(v, v), _mm_setzero_si128() );
+
+		return _mm_unpacklo_epi16( _mm_unpacklo_epi8(s, _mm_setzero_si128()), _mm_setzero_si128() );
+	}
+
+	// write 4 values (32 bit lanes, 0..255) into byte 'lane' of 4 texels.
+	static void Put_SSE2(unsigned char * d, __m128i v, int lane) {
+
+		const __m128i mask = _mm_set1_epi32( ~(0xff << (8*lane)) );
+
+		__m128i t = _mm_loadu_si128( reinterpret_cast<__m128i *>(d) );
+
+		switch(lane) {
+		case 1: v = _mm_slli_epi32(v,  8); break;
+		case 2: v = _mm_slli_epi32(v, 16); break;
+		case 3: v = _mm_slli_epi32(v, 24); break;
+		}
+
+		t = _mm_or_si128( _mm_and_si128(t, mask), v );
+
+		_mm_storeu_si128( reinterpret_cast<__m128i *>(d), t );
+	}
+
+	// 8x2 RGBA pixels at (x,y).
+	static void Block_SSE2(const unsigned char * src, int pitch, int x, int y,
+		unsigned char * dy, int dy_pitch, unsigned char * dcb, unsigned char * dcr, int dc_pitch, unsigned char * da, int lane)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		const unsigned char * s0 = src + pitch * y + 4 * x;
+		const unsigned char * s1 = s0 + pitch;
+
+		const __m128i p00 = _mm_loadu_si128( reinterpret_cast<const __m128i *>(s0) );
+		const __m128i p01 = _mm_loadu_si128( reinterpret_cast<const __m128i *>(s0 + 16) );
+		const __m128i p10 = _mm_loadu_si128( reinterpret_cast<const __m128i *>(s1) );
+		const __m128i p11 = _mm_loadu_si128( reinterpret_cast<const __m128i *>(s1 + 16) );
+
+		unsigned char * y0 = dy + dy_pitch * y + 4 * x;
+		unsigned char * y1 = y0 + dy_pitch;
+
+		Put_SSE2( y0,      Luma_SSE2(p00), lane );
+		Put_SSE2( y0 + 16, Luma_SSE2(p01), lane );
+		Put_SSE2( y1,      Luma_SSE2(p10), lane );
+		Put_SSE2( y1 + 16, Luma_SSE2(p11), lane );
+
+		if(da) {
+			unsigned char * a0 = da + dy_pitch * y + 4 * x;
+			unsigned char * a1 = a0 + dy_pitch;
+			Put_SSE2( a0,      _mm_srli_epi32(p00, 24), lane );
+			Put_SSE2( a0 + 16, _mm_srli_epi32(p01, 24), lane );
+			Put_SSE2( a1,      _mm_srli_epi32(p10, 24), lane );
+			Put_SSE2( a1 + 16, _mm_srli_epi32(p11, 24), lane );
+		}
+
+		// sum the 2 rows, then neighbouring pixels, for 4 quads of 16 bit r,g,b,a.
+		const __m128i r0 = _mm_add_epi16( _mm_unpacklo_epi8(p00, zero), _mm_unpacklo_epi8(p10, zero) );	// px 0,1
+		const __m128i r1 = _mm_add_epi16( _mm_unpackhi_epi8(p00, zero), _mm_unpackhi_epi8(p10, zero) );	// px 2,3
+		const __m128i r2 = _mm_add_epi16( _mm_unpacklo_epi8(p01, zero), _mm_unpacklo_epi8(p11, zero) );	// px 4,5
+		const __m128i r3 = _mm_add_epi16( _mm_unpackhi_epi8(p01, zero), _mm_unpackhi_epi8(p11, zero) );	// px 6,7
+
+		const __m128i q01 = _mm_add_epi16( _mm_unpacklo_epi64(r0, r1), _mm_unpackhi_epi64(r0, r1) );	// quads 0,1
+		const __m128i q23 = _mm_add_epi16( _mm_unpacklo_epi64(r2, r3), _mm_unpackhi_epi64(r2, r3) );	// quads 2,3
+
+		const int cx = x / 2;
+		const int cy = y / 2;
+
+		Put_SSE2( dcb + dc_pitch * cy + 4 * cx, Chroma_SSE2(q01, q23, _mm_setr_epi16(-43, -85, 128, 0, -43, -85, 128, 0)), lane );
+		Put_SSE2( dcr + dc_pitch * cy + 4 * cx, Chroma_SSE2(q01, q23, _mm_setr_epi16(128, -107, -21, 0, 128, -107, -21, 0)), lane );
+	}
+#endif
+
+	// one plane into byte 'lane' of a texture, repeating the last row and column into any padding.
+	static void Interleave(const unsigned char * s, int pitch, int w, int h,
+		unsigned char * d, int d_pitch, int dw, int dh, int lane)
+	{
+		for(int y=0;y<dh;y++) {
+
+			const unsigned char * src = s + pitch * std::min(y, h-1);
+			unsigned char * dst = d + d_pitch * y + lane;
+
+			int x = 0;
+			for(;x<w;x++)
+				dst[4*x] = src[x];
+			for(;x<dw;x++)
+				dst[4*x] = src[w-1];
+		}
+	}
+
+public:
+
+	// Copies an already YCbCr(A) 4:2:0 frame, e.g. from a Y4M stream, into one lane of the textures.
+	// src must be YUV420P or YUVA420P and no bigger than the destinations, which are padded with its edges.
+	static bool FromYCbCrA420(const Image & src, Image & Y, Image & Cb, Image & Cr, Image * A, int lane) {
+
+		if(src.Format() != IMG_FMT_YUV420P && src.Format() != IMG_FMT_YUVA420P)
+			return false;
+
+		const int w = src.Width();
+		const int h = src.Height();
+		const int cw = (w+1)/2;
+		const int ch = (h+1)/2;
+
+		if( Y.Width() < w || Y.Height() < h ||
+			Cb.Width() < cw || Cb.Height() < ch ||
+			Cr.Width() < cw || Cr.Height() < ch ||
+			(A && (A->Width() < w || A->Height() < h)) )
+			return false;
+
+		Interleave(static_cast<const unsigned char *>(src.Data(0)), src.LineSize(0), w, h,
+			static_cast<unsigned char *>(Y.Data(0)), Y.LineSize(0), Y.Width(), Y.Height(), lane);
+		Interleave(static_cast<const unsigned char *>(src.Data(1)), src.LineSize(1), cw, ch,
+			static_cast<unsigned char *>(Cb.Data(0)), Cb.LineSize(0), Cb.Width(), Cb.Height(), lane);
+		Interleave(static_cast<const unsigned char *>(src.Data(2)), src.LineSize(2), cw, ch,
+			static_cast<unsigned char *>(Cr.Data(0)), Cr.LineSize(0), Cr.Width(), Cr.Height(), lane);
+
+		// without source alpha, A keeps the opaque fill it was cleared to.
+		if(A && src.Format() == IMG_FMT_YUVA420P)
+			Interleave(static_cast<const unsigned char *>(src.Data(3)), src.LineSize(3), w, h,
+				static_cast<unsigned char *>(A->Data(0)), A->LineSize(0), A->Width(), A->Height(), lane);
+
+		return true;
+	}
+
+	// src must be RGBA32 or RGB24, and the destinations RGBA32 textures at least as big as src
+	//  ( half size for Cb and Cr ). A may be NULL.
+	static bool ToYCbCrA420(const Image & src, Image & Y, Image & Cb, Image & Cr, Image * A, int lane) {
+
+		int bpp;
+
+		switch(src.Format()) {
+		case IMG_FMT_RGBA32: bpp = 4; break;
+		case IMG_FMT_RGB24:  bpp = 3; break;
+		default:
+			return false;
+		}
+
+		const int w = src.Width();
+		const int h = src.Height();
+		const int cw = (w+1)/2;
+		const int ch = (h+1)/2;
+
+		if( Y.Width() < w || Y.Height() < h ||
+			Cb.Width() < cw || Cb.Height() < ch ||
+			Cr.Width() < cw || Cr.Height() < ch ||
+			(A && (A->Width() < w || A->Height() < h)) ||
+			Cb.LineSize(0) != Cr.LineSize(0) ||
+			(A && A->LineSize(0) != Y.LineSize(0)) )
+			return false;
+
+		const unsigned char * s = static_cast<const unsigned char *>(src.Data(0));
+		unsigned char * dy  = static_cast<unsigned char *>(Y.Data(0));
+		unsigned char * dcb = static_cast<unsigned char *>(Cb.Data(0));
+		unsigned char * dcr = static_cast<unsigned char *>(Cr.Data(0));
+		unsigned char * da  = A ? static_cast<unsigned char *>(A->Data(0)) : NULL;
+
+		const int pitch = src.LineSize(0);
+		const int dy_pitch = Y.LineSize(0);
+		const int dc_pitch = Cb.LineSize(0);
+
+		for(int y=0;y<h;y+=2) {
+
+			int x = 0;
+
+#if defined(__SSE2__)
+			if(bpp == 4 && y+1 < h)
+				for(;x+8<=w;x+=8)
+					Block_SSE2(s, pitch, x, y, dy, dy_pitch, dcb, dcr, dc_pitch, da, lane);
+#endif
+			for(;x<w;x+=2)
+				Quad(s, pitch, bpp, w, h, x, y, dy, dy_pitch,
+					dcb + dc_pitch * (y/2) + 4 * (x/2) + lane,
+					dcr + dc_pitch * (y/2) + 4 * (x/2) + lane,
+					da, lane);
+		}
+
+		return true;
+	}
+};
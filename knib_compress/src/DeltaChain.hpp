@@ -0,0 +1,89 @@
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+// Hands the texture compressed planes of each set on to the worker encoding the set after it,
+//  which stores its planes XORed with them ( KNIB_DATA_DELTA ), or compresses them with them
+//  as a dictionary. ( KNIB_DATA_DICT )
+// Every 'key_interval'th set is a key set, stored as it is, so readers can seek to it.
+// Workers publish their planes as soon as they are final, so only the XOR or LZ4 wait on the set before.
+class DeltaChain {
+
+public:
+
+	typedef std::vector<char> Planes; // Y, Cb, Cr and A, one after another.
+
+private:
+
+	const int key_interval;
+	const bool dictionary;
+
+	std::mutex mutex;
+	std::condition_variable published;
+
+	// planes waiting for the set after them.
+	std::map<int, std::shared_ptr<const Planes> > planes;
+
+	bool aborted{false}; // see 'Abort'
+
+public:
+
+	DeltaChain(int key_interval, bool dictionary = false)
+		:	key_interval(key_interval > 0 ? key_interval : 1),
+		 	dictionary(dictionary)
+	{}
+
+	DeltaChain(const DeltaChain &) = delete;
+
+	// true for KNIB_DATA_DICT, false for KNIB_DATA_DELTA.
+	bool Dictionary() const { return dictionary; }
+
+	bool IsKeySet(int set_index) const {
+
+		return (set_index % key_interval) == 0;
+	}
+
+	void Publish(int set_index, std::shared_ptr<const Planes> set_planes) {
+
+		// nothing builds on the set before a key set.
+		if(IsKeySet(set_index + 1))
+			return;
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		planes[set_index] = set_planes;
+		published.notify_all();
+	}
+
+	// a set failed before publishing its planes, stop the sets after it waiting for them.
+	void Abort() {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		aborted = true;
+		published.notify_all();
+	}
+
+	// waits for the planes of the set before 'set_index'. null once aborted.
+	std::shared_ptr<const Planes> Previous(int set_index) {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		std::map<int, std::shared_ptr<const Planes> >::iterator itor;
+
+		while( (itor = planes.find(set_index - 1)) == planes.end() ) {
+			if(aborted)
+				return std::shared_ptr<const Planes>();
+			published.wait( lock );
+		}
+
+		std::shared_ptr<const Planes> previous = itor->second;
+		planes.erase(itor);
+		return previous;
+	}
+};
@@ -0,0 +1,496 @@
+
+#pragma once
+
+#include <libimgutil.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// DXT1 (BC1) encoder for RGBA32 planes.
+// Knib textures carry 3 strongly correlated samples per texel (the same plane from 3 frames),
+//  so a principal axis fit with least squares refinement does well, and only ever needs
+//  the 4 colour mode. Alpha is ignored.
+// The palette search is the hot loop, it has SSE2 and AVX2 versions that give exactly the same
+//  result as the scalar code.
+class Dxt1Encoder {
+
+public:
+
+	enum Isa {
+		SCALAR,
+		SSE2,
+		AVX2,
+	};
+
+	// best instruction set this build was compiled for.
+	static Isa BestIsa() {
+#if defined(__AVX2__)
+		return AVX2;
+#elif defined(__SSE2__)
+		return SSE2;
+#else
+		return SCALAR;
+#endif
+	}
+
+private:
+
+	static int R(uint32_t c) { return (c      ) & 0xff; }
+	static int G(uint32_t c) { return (c >>  8) & 0xff; }
+	static int B(uint32_t c) { return (c >> 16) & 0xff; }
+
+	static uint32_t Pack(int r, int g, int b) {
+
+		return r | (g << 8) | (b << 16);
+	}
+
+	static int Clamp(int v) {
+
+		return v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+
+	static uint16_t To565(int r, int g, int b) {
+
+		r = Clamp(r);
+		g = Clamp(g);
+		b = Clamp(b);
+
+		return	(((r * 31 + 127) / 255) << 11) |
+				(((g * 63 + 127) / 255) <<  5) |
+				 ((b * 31 + 127) / 255);
+	}
+
+	static uint32_t From565(uint16_t c) {
+
+		const int r = (c >> 11) & 31;
+		const int g = (c >>  5) & 63;
+		const int b = (c      ) & 31;
+
+		return Pack( (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) );
+	}
+
+	// 4 colour mode palette, in index order.
+	static void Palette(uint16_t c0, uint16_t c1, uint32_t pal[4]) {
+
+		const uint32_t a = From565(c0);
+		const uint32_t b = From565(c1);
+
+		pal[0] = a;
+		pal[1] = b;
+		pal[2] = Pack( (2*R(a)+R(b))/3, (2*G(a)+G(b))/3, (2*B(a)+B(b))/3 );
+		pal[3] = Pack( (R(a)+2*R(b))/3, (G(a)+2*G(b))/3, (B(a)+2*B(b))/3 );
+	}
+
+	// Nearest palette entry for each pixel. Returns the packed 2 bit indices, sets err to the squared error.
+	static uint32_t Indices_Scalar(const uint32_t px[16], const uint32_t pal[4], int & err) {
+
+		uint32_t indices = 0;
+		err = 0;
+
+		for(int i=0;i<16;i++) {
+
+			int best = 0x7fffffff;
+			int idx = 0;
+
+			for(int k=0;k<4;k++) {
+
+				const int dr = R(px[i]) - R(pal[k]);
+				const int dg = G(px[i]) - G(pal[k]);
+				const int db = B(px[i]) - B(pal[k]);
+				const int d = dr*dr + dg*dg + db*db;
+
+				if(d < best) {
+					best = d;
+					idx = k;
+				}
+			}
+
+			indices |= idx << (2*i);
+			err += best;
+		}
+
+		return indices;
+	}
+
+#if defined(__SSE2__)
+	// squared RGB distance of 4 pixels from c.
+	static __m128i Dist_SSE2(__m128i p, __m128i c) {
+
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i ad = _mm_or_si128( _mm_subs_epu8(p, c), _mm_subs_epu8(c, p) );
+		const __m128i lo = _mm_unpacklo_epi8(ad, zero);
+		const __m128i hi = _mm_unpackhi_epi8(ad, zero);
+		const __m128i slo = _mm_madd_epi16(lo, lo);	// rg0 ba0 rg1 ba1
+		const __m128i shi = _mm_madd_epi16(hi, hi);	// rg2 ba2 rg3 ba3
+		const __m128 e = _mm_shuffle_ps( _mm_castsi128_ps(slo), _mm_castsi128_ps(shi), _MM_SHUFFLE(2,0,2,0) );
+		const __m128 o = _mm_shuffle_ps( _mm_castsi128_ps(slo), _mm_castsi128_ps(shi), _MM_SHUFFLE(3,1,3,1) );
+
+		return _mm_add_epi32( _mm_castps_si128(e), _mm_castps_si128(o) );
+	}
+
+	static uint32_t Indices_SSE2(const uint32_t px[16], const uint32_t pal[4], int & err) {
+
+		__m128i total = _mm_setzero_si128();
+		uint32_t indices = 0;
+
+		for(int i=0;i<16;i+=4) {
+
+			const __m128i p = _mm_loadu_si128( reinterpret_cast<const __m128i *>(px + i) );
+
+			__m128i best = Dist_SSE2(p, _mm_set1_epi32(pal[0]));
+			__m128i idx = _mm_setzero_si128();
+
+			for(int k=1;k<4;k++) {
+
+				const __m128i d = Dist_SSE2(p, _mm_set1_epi32(pal[k]));
+				const __m128i m = _mm_cmplt_epi32(d, best);
+
+				best = _mm_or_si128( _mm_and_si128(m, d), _mm_andnot_si128(m, best) );
+				idx  = _mm_or_si128( _mm_and_si128(m, _mm_set1_epi32(k)), _mm_andnot_si128(m, idx) );
+			}
+
+			total = _mm_add_epi32(total, best);
+
+			// gather the 2 bit indices, (idx | idx>>30) puts lanes 0,1 and 2,3 in adjacent bit pairs.
+			const __m128i packed = _mm_or_si128( idx, _mm_srli_epi64( idx, 30 ) );
+			const uint32_t lo = _mm_cvtsi128_si32( packed );
+			const uint32_t hi = _mm_cvtsi128_si32( _mm_srli_si128( packed, 8 ) );
+
+			indices |= ((lo & 15) | ((hi & 15) << 4)) << (2*i);
+		}
+
+		total = _mm_add_epi32( total, _mm_srli_si128(total, 8) );
+		total = _mm_add_epi32( total, _mm_srli_si128(total, 4) );
+		err = _mm_cvtsi128_si32(total);
+
+		return indices;
+	}
+#endif
+
+#if defined(__AVX2__)
+	// squared RGB distance of 8 pixels from c.
+	static __m256i Dist_AVX2(__m256i p, __m256i c) {
+
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i ad = _mm256_or_si256( _mm256_subs_epu8(p, c), _mm256_subs_epu8(c, p) );
+		const __m256i lo = _mm256_unpacklo_epi8(ad, zero);
+		const __m256i hi = _mm256_unpackhi_epi8(ad, zero);
+		const __m256i slo = _mm256_madd_epi16(lo, lo);
+		const __m256i shi = _mm256_madd_epi16(hi, hi);
+		const __m256 e = _mm256_shuffle_ps( _mm256_castsi256_ps(slo), _mm256_castsi256_ps(shi), _MM_SHUFFLE(2,0,2,0) );
+		const __m256 o = _mm256_shuffle_ps( _mm256_castsi256_ps(slo), _mm256_castsi256_ps(shi), _MM_SHUFFLE(3,1,3,1) );
+
+		return _mm256_add_epi32( _mm256_castps_si256(e), _mm256_castps_si256(o) );
+	}
+
+	static uint32_t Indices_AVX2(const uint32_t px[16], const uint32_t pal[4], int & err) {
+
+		__m256i total = _mm256_setzero_si256();
+		uint32_t indices = 0;
+
+		for(int i=0;i<16;i+=8) {
+
+			const __m256i p = _mm256_loadu_si256( reinterpret_cast<const __m256i *>(px + i) );
+
+			__m256i best = Dist_AVX2(p, _mm256_set1_epi32(pal[0]));
+			__m256i idx = _mm256_setzero_si256();
+
+			for(int k=1;k<4;k++) {
+
+				const __m256i d = Dist_AVX2(p, _mm256_set1_epi32(pal[k]));
+				const __m256i m = _mm256_cmpgt_epi32(best, d);
+
+				best = _mm256_blendv_epi8( best, d, m );
+				idx  = _mm256_blendv_epi8( idx, _mm256_set1_epi32(k), m );
+			}
+
+			total = _mm256_add_epi32(total, best);
+
+			// shift each lane's index into place, then OR the lanes together.
+			const __m256i shifted = _mm256_sllv_epi32( idx, _mm256_setr_epi32(0,2,4,6,8,10,12,14) );
+			__m128i bits = _mm_or_si128( _mm256_castsi256_si128(shifted), _mm256_extracti128_si256(shifted, 1) );
+			bits = _mm_or_si128( bits, _mm_srli_si128(bits, 8) );
+			bits = _mm_or_si128( bits, _mm_srli_si128(bits, 4) );
+
+			indices |= (uint32_t)_mm_cvtsi128_si32(bits) << (2*i);
+		}
+
+		__m128i t = _mm_add_epi32( _mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1) );
+		t = _mm_add_epi32( t, _mm_srli_si128(t, 8) );
+		t = _mm_add_epi32( t, _mm_srli_si128(t, 4) );
+		err = _mm_cvtsi128_si32(t);
+
+		return indices;
+	}
+#endif
+
+	static uint32_t Indices(const uint32_t px[16], const uint32_t pal[4], int & err, Isa isa) {
+
+		switch(isa) {
+#if defined(__AVX2__)
+		case AVX2:
+			return Indices_AVX2(px, pal, err);
+#endif
+#if defined(__SSE2__)
+		case SSE2:
+			return Indices_SSE2(px, pal, err);
+#endif
+		default:
+			return Indices_Scalar(px, pal, err);
+		}
+	}
+
+	// Fast endpoints, the inset corners of the bounding box along its main diagonal.
+	static void BoundingBox(const uint32_t px[16], uint16_t & c0, uint16_t & c1) {
+
+		int mn[3] = {255,255,255};
+		int mx[3] = {0,0,0};
+
+		for(int i=0;i<16;i++) {
+			const int c[3] = { R(px[i]), G(px[i]), B(px[i]) };
+			for(int j=0;j<3;j++) {
+				mn[j] = std::min(mn[j], c[j]);
+				mx[j] = std::max(mx[j], c[j]);
+			}
+		}
+
+		// orient the diagonal to follow the channel with the largest range.
+		int ref = 0;
+		for(int j=1;j<3;j++)
+			if(mx[j]-mn[j] > mx[ref]-mn[ref])
+				ref = j;
+
+		int cov[3] = {0,0,0};
+		for(int i=0;i<16;i++) {
+			const int c[3] = { R(px[i]), G(px[i]), B(px[i]) };
+			for(int j=0;j<3;j++)
+				cov[j] += (2*c[ref] - mn[ref] - mx[ref]) * (2*c[j] - mn[j] - mx[j]);
+		}
+
+		for(int j=0;j<3;j++) {
+
+			const int inset = (mx[j] - mn[j]) >> 4;
+
+			mn[j] += inset;
+			mx[j] -= inset;
+
+			if(cov[j] < 0)
+				std::swap(mn[j], mx[j]);
+		}
+
+		c0 = To565(mx[0], mx[1], mx[2]);
+		c1 = To565(mn[0], mn[1], mn[2]);
+	}
+
+	// Endpoints from the pixels furthest apart along the principal axis.
+	static void PrincipalAxis(const uint32_t px[16], uint16_t & c0, uint16_t & c1) {
+
+		float mean[3] = {0,0,0};
+		int mn[3] = {255,255,255};
+		int mx[3] = {0,0,0};
+
+		for(int i=0;i<16;i++) {
+			const int c[3] = { R(px[i]), G(px[i]), B(px[i]) };
+			for(int j=0;j<3;j++) {
+				mean[j] += c[j];
+				mn[j] = std::min(mn[j], c[j]);
+				mx[j] = std::max(mx[j], c[j]);
+			}
+		}
+		for(int j=0;j<3;j++)
+			mean[j] /= 16.0f;
+
+		float cov[6] = {0,0,0,0,0,0};
+		for(int i=0;i<16;i++) {
+			const float r = R(px[i]) - mean[0];
+			const float g = G(px[i]) - mean[1];
+			const float b = B(px[i]) - mean[2];
+			cov[0] += r*r;
+			cov[1] += r*g;
+			cov[2] += r*b;
+			cov[3] += g*g;
+			cov[4] += g*b;
+			cov[5] += b*b;
+		}
+
+		float axis[3] = { float(mx[0]-mn[0]), float(mx[1]-mn[1]), float(mx[2]-mn[2]) };
+
+		for(int iter=0;iter<4;iter++) {
+
+			const float r = axis[0]*cov[0] + axis[1]*cov[1] + axis[2]*cov[2];
+			const float g = axis[0]*cov[1] + axis[1]*cov[3] + axis[2]*cov[4];
+			const float b = axis[0]*cov[2] + axis[1]*cov[4] + axis[2]*cov[5];
+
+			const float m = std::max( fabsf(r), std::max( fabsf(g), fabsf(b) ) );
+			if(m < 1e-6f)
+				break;
+
+			axis[0] = r / m;
+			axis[1] = g / m;
+			axis[2] = b / m;
+		}
+
+		int lo = 0, hi = 0;
+		float dlo = 1e30f, dhi = -1e30f;
+		for(int i=0;i<16;i++) {
+			const float d = R(px[i])*axis[0] + G(px[i])*axis[1] + B(px[i])*axis[2];
+			if(d < dlo) { dlo = d; lo = i; }
+			if(d > dhi) { dhi = d; hi = i; }
+		}
+
+		c0 = To565( R(px[hi]), G(px[hi]), B(px[hi]) );
+		c1 = To565( R(px[lo]), G(px[lo]), B(px[lo]) );
+	}
+
+	// Least squares endpoints for a fixed set of indices, false if they don't constrain both endpoints.
+	static bool Refine(const uint32_t px[16], uint32_t indices, uint16_t & c0, uint16_t & c1) {
+
+		static const float w0[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+
+		float aa = 0, bb = 0, ab = 0;
+		float ax[3] = {0,0,0};
+		float bx[3] = {0,0,0};
+
+		for(int i=0;i<16;i++) {
+
+			const float a = w0[ (indices >> (2*i)) & 3 ];
+			const float b = 1.0f - a;
+			const float c[3] = { float(R(px[i])), float(G(px[i])), float(B(px[i])) };
+
+			aa += a*a;
+			bb += b*b;
+			ab += a*b;
+			for(int j=0;j<3;j++) {
+				ax[j] += a*c[j];
+				bx[j] += b*c[j];
+			}
+		}
+
+		const float det = aa*bb - ab*ab;
+		if(fabsf(det) < 1e-6f)
+			return false;
+
+		int e0[3], e1[3];
+		for(int j=0;j<3;j++) {
+			e0[j] = (int)floorf( (ax[j]*bb - bx[j]*ab) / det + 0.5f );
+			e1[j] = (int)floorf( (bx[j]*aa - ax[j]*ab) / det + 0.5f );
+		}
+
+		c0 = To565(e0[0], e0[1], e0[2]);
+		c1 = To565(e1[0], e1[1], e1[2]);
+
+		return true;
+	}
+
+	// indices and error for a pair of endpoints, ordered for the 4 colour mode ( c0 > c1 ).
+	static void Evaluate(const uint32_t px[16], uint16_t & c0, uint16_t & c1, uint32_t & indices, int & err, Isa isa) {
+
+		if(c0 < c1)
+			std::swap(c0, c1);
+
+		uint32_t pal[4];
+		Palette(c0, c1, pal);
+
+		// c0 == c1 selects the 3 colour mode, but every index comes out 0 so it doesn't matter.
+		indices = Indices(px, pal, err, isa);
+	}
+
+public:
+
+	// Encode one block of 16 RGBA pixels (alpha must be 0) to 8 bytes.
+	static void EncodeBlock(const uint32_t px[16], unsigned char * out, copy_quality_t quality, Isa isa) {
+
+		uint16_t c0, c1;
+		uint32_t indices;
+		int err;
+
+		int refinements = 0;
+
+		switch(quality) {
+		case COPY_QUALITY_LOWEST:
+			BoundingBox(px, c0, c1);
+			break;
+		case COPY_QUALITY_MEDIUM:
+			PrincipalAxis(px, c0, c1);
+			refinements = 1;
+			break;
+		default:
+			PrincipalAxis(px, c0, c1);
+			refinements = 2;
+			break;
+		}
+
+		Evaluate(px, c0, c1, indices, err, isa);
+
+		for(int i=0;i<refinements && err;i++) {
+
+			uint16_t n0, n1;
+			uint32_t nindices;
+			int nerr;
+
+			if(!Refine(px, indices, n0, n1))
+				break;
+
+			Evaluate(px, n0, n1, nindices, nerr, isa);
+
+			if(nerr >= err)
+				break;
+
+			c0 = n0;
+			c1 = n1;
+			indices = nindices;
+			err = nerr;
+		}
+
+		out[0] = c0 & 0xff;
+		out[1] = c0 >> 8;
+		out[2] = c1 & 0xff;
+		out[3] = c1 >> 8;
+		out[4] = indices & 0xff;
+		out[5] = (indices >>  8) & 0xff;
+		out[6] = (indices >> 16) & 0xff;
+		out[7] = (indices >> 24) & 0xff;
+	}
+
+	// Encode a w*h RGBA32 image with 'pitch' bytes per row. Edge blocks repeat the last row / column.
+	static void Encode(void * dst, const void * src, int w, int h, int pitch, copy_quality_t quality, Isa isa = BestIsa()) {
+
+		unsigned char * out = static_cast<unsigned char *>(dst);
+		const unsigned char * in = static_cast<const unsigned char *>(src);
+
+		uint32_t px[16];
+
+		for(int by=0;by<h;by+=4) {
+			for(int bx=0;bx<w;bx+=4) {
+
+				if(bx+4 <= w && by+4 <= h) {
+					for(int y=0;y<4;y++) {
+						memcpy(px + 4*y, in + pitch * (by+y) + 4 * bx, 16);
+						for(int x=0;x<4;x++)
+							px[4*y+x] &= 0x00ffffff;
+					}
+				}
+				else {
+					for(int y=0;y<4;y++) {
+						const unsigned char * row = in + pitch * std::min(by+y, h-1);
+						for(int x=0;x<4;x++) {
+							const unsigned char * p = row + 4 * std::min(bx+x, w-1);
+							px[4*y+x] = Pack(p[0], p[1], p[2]);
+						}
+					}
+				}
+
+				EncodeBlock(px, out, quality, isa);
+				out += 8;
+			}
+		}
+	}
+};
@@ -0,0 +1,530 @@
+
+#pragma once
+
+#include <libimgutil.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// ETC1 encoder for RGBA32 planes.
+// Each 4x4 block is tried as two 2x4 or two 4x2 sub-blocks, in both the individual and the
+//  differential base colour modes. For each candidate base colour every modifier table is searched
+//  for the best modifier per pixel, the SSE2 version does 8 pixels at a time and gives exactly the
+//  same result as the scalar code.
+// The quality setting picks how many base colours are tried around each sub-block's average:
+//  LO just the average, MED also a step brighter and darker, HI two steps along the grey
+//  (luma) axis plus a step in each channel.
+// Flat blocks skip the flip and mode search. Alpha is ignored.
+class Etc1Encoder {
+
+public:
+
+	enum Isa {
+		SCALAR,
+		SSE2,
+	};
+
+	// best instruction set this build was compiled for.
+	static Isa BestIsa() {
+#if defined(__SSE2__)
+		return SSE2;
+#else
+		return SCALAR;
+#endif
+	}
+
+private:
+
+	// 8 pixels of one sub-block, a channel per array.
+	struct SubBlock {
+		alignas(16) int16_t r[8];
+		alignas(16) int16_t g[8];
+		alignas(16) int16_t b[8];
+	};
+
+	// best modifier table for one sub-block and base colour.
+	struct Fit {
+		int err;
+		int table;
+		uint8_t idx[8];	// pixel index, 0:+a 1:+b 2:-a 3:-b
+	};
+
+	struct Candidate {
+		int err;
+		bool diff;
+		bool flip;
+		int base[2][3];	// quantised, 4 bit for individual mode, 5 bit for differential.
+		Fit fit[2];
+	};
+
+	static const int * Modifiers(int table) {
+
+		static const int modifiers[8][4] = {
+			{   2,   8,   -2,   -8 },
+			{   5,  17,   -5,  -17 },
+			{   9,  29,   -9,  -29 },
+			{  13,  42,  -13,  -42 },
+			{  18,  60,  -18,  -60 },
+			{  24,  80,  -24,  -80 },
+			{  33, 106,  -33, -106 },
+			{  47, 183,  -47, -183 },
+		};
+
+		return modifiers[table];
+	}
+
+	// raster pixel numbers of each sub-block, [flip][sub-block][pixel]
+	static const int * SubPixels(int flip, int sub) {
+
+		static const int pixels[2][2][8] = {
+			{ { 0, 1, 4, 5, 8, 9,12,13 }, { 2, 3, 6, 7,10,11,14,15 } },
+			{ { 0, 1, 2, 3, 4, 5, 6, 7 }, { 8, 9,10,11,12,13,14,15 } },
+		};
+
+		return pixels[flip][sub];
+	}
+
+	static int Clamp(int v, int lo, int hi) {
+
+		return v < lo ? lo : v > hi ? hi : v;
+	}
+
+	static int Expand(int c, bool diff) {
+
+		return diff ? ((c << 3) | (c >> 2)) : ((c << 4) | c);
+	}
+
+	// A modifier is added to all 3 channels, so while nothing clamps the error of modifier m is
+	//  |p-base|^2 - 2*m*s + 3*m^2, where s is the pixel's summed offset from base. The best
+	//  modifier then only depends on s, and the error is exact.
+	static bool Unclamped(const int base[3], int table) {
+
+		const int m = Modifiers(table)[1];
+
+		return	std::max( base[0], std::max(base[1], base[2]) ) + m <= 255 &&
+				std::min( base[0], std::min(base[1], base[2]) ) - m >= 0;
+	}
+
+	static void FitTables_Scalar(const SubBlock & s, const int base[3], Fit & fit) {
+
+		int e0 = 0;
+		int sum[8];
+
+		for(int i=0;i<8;i++) {
+			const int dr = s.r[i] - base[0];
+			const int dg = s.g[i] - base[1];
+			const int db = s.b[i] - base[2];
+			e0 += dr*dr + dg*dg + db*db;
+			sum[i] = dr + dg + db;
+		}
+
+		fit.err = INT_MAX;
+
+		for(int t=0;t<8;t++) {
+
+			const int * mod = Modifiers(t);
+
+			int err = 0;
+			uint8_t idx[8];
+
+			if(Unclamped(base, t)) {
+
+				const int a = mod[0];
+				const int b = mod[1];
+
+				err = e0;
+
+				for(int i=0;i<8;i++) {
+					const int as = sum[i] < 0 ? -sum[i] : sum[i];
+					const int large = 2*as > 3*(a+b);
+					const int m = large ? b : a;
+					err += 3*m*m - 2*m*as;
+					idx[i] = (sum[i] < 0 ? 2 : 0) + large;
+				}
+			}
+			else {
+
+				int v[4][3];
+				for(int m=0;m<4;m++)
+					for(int c=0;c<3;c++)
+						v[m][c] = Clamp(base[c] + mod[m], 0, 255);
+
+				for(int i=0;i<8 && err < fit.err;i++) {
+
+					int best = INT_MAX;
+
+					for(int m=0;m<4;m++) {
+
+						const int dr = s.r[i] - v[m][0];
+						const int dg = s.g[i] - v[m][1];
+						const int db = s.b[i] - v[m][2];
+						const int d = dr*dr + dg*dg + db*db;
+
+						if(d < best) {
+							best = d;
+							idx[i] = m;
+						}
+					}
+
+					err += best;
+				}
+			}
+
+			if(err < fit.err) {
+				fit.err = err;
+				fit.table = t;
+				memcpy(fit.idx, idx, 8);
+			}
+		}
+	}
+
+#if defined(__SSE2__)
+	static int HorizontalSum(__m128i v) {
+
+		v = _mm_add_epi32( v, _mm_srli_si128(v, 8) );
+		v = _mm_add_epi32( v, _mm_srli_si128(v, 4) );
+
+		return _mm_cvtsi128_si32(v);
+	}
+
+	static __m128i Select(__m128i mask, __m128i a, __m128i b) {
+
+		return _mm_or_si128( _mm_and_si128(mask, a), _mm_andnot_si128(mask, b) );
+	}
+
+	// squared distance of 8 pixels from (r,g,b), as 2 x 4 ints.
+	static void Dist_SSE2(__m128i dr, __m128i dg, __m128i db, __m128i & lo, __m128i & hi) {
+
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rg_lo = _mm_unpacklo_epi16(dr, dg);
+		const __m128i rg_hi = _mm_unpackhi_epi16(dr, dg);
+		const __m128i b_lo  = _mm_unpacklo_epi16(db, zero);
+		const __m128i b_hi  = _mm_unpackhi_epi16(db, zero);
+
+		lo = _mm_add_epi32( _mm_madd_epi16(rg_lo, rg_lo), _mm_madd_epi16(b_lo, b_lo) );
+		hi = _mm_add_epi32( _mm_madd_epi16(rg_hi, rg_hi), _mm_madd_epi16(b_hi, b_hi) );
+	}
+
+	static void FitTables_SSE2(const SubBlock & s, const int base[3], Fit & fit) {
+
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i r = _mm_load_si128( reinterpret_cast<const __m128i *>(s.r) );
+		const __m128i g = _mm_load_si128( reinterpret_cast<const __m128i *>(s.g) );
+		const __m128i b = _mm_load_si128( reinterpret_cast<const __m128i *>(s.b) );
+
+		const __m128i dr = _mm_sub_epi16( r, _mm_set1_epi16(base[0]) );
+		const __m128i dg = _mm_sub_epi16( g, _mm_set1_epi16(base[1]) );
+		const __m128i db = _mm_sub_epi16( b, _mm_set1_epi16(base[2]) );
+
+		__m128i e_lo, e_hi;
+		Dist_SSE2(dr, dg, db, e_lo, e_hi);
+		const int e0 = HorizontalSum( _mm_add_epi32(e_lo, e_hi) );
+
+		// |s| and the sign of s as 32 bit lanes, |s| <= 765 so it can go through madd.
+		const __m128i sum = _mm_add_epi16( _mm_add_epi16(dr, dg), db );
+		const __m128i sign = _mm_srai_epi16(sum, 15);
+		const __m128i as = _mm_sub_epi16( _mm_xor_si128(sum, sign), sign );
+		const __m128i as_lo = _mm_unpacklo_epi16(as, zero);
+		const __m128i as_hi = _mm_unpackhi_epi16(as, zero);
+		const __m128i neg = _mm_and_si128( _mm_packs_epi16(sign, zero), _mm_set1_epi8(2) );
+
+		fit.err = INT_MAX;
+
+		for(int t=0;t<8;t++) {
+
+			const int * mod = Modifiers(t);
+
+			int err;
+			__m128i idx;
+
+			if(Unclamped(base, t)) {
+
+				const int ma = mod[0];
+				const int mb = mod[1];
+
+				const __m128i limit = _mm_set1_epi32( 3*(ma+mb) );
+				const __m128i l_lo = _mm_cmpgt_epi32( _mm_add_epi32(as_lo, as_lo), limit );
+				const __m128i l_hi = _mm_cmpgt_epi32( _mm_add_epi32(as_hi, as_hi), limit );
+
+				const __m128i m_lo = Select( l_lo, _mm_set1_epi32(mb), _mm_set1_epi32(ma) );
+				const __m128i m_hi = Select( l_hi, _mm_set1_epi32(mb), _mm_set1_epi32(ma) );
+				const __m128i q_lo = Select( l_lo, _mm_set1_epi32(3*mb*mb), _mm_set1_epi32(3*ma*ma) );
+				const __m128i q_hi = Select( l_hi, _mm_set1_epi32(3*mb*mb), _mm_set1_epi32(3*ma*ma) );
+
+				// 3*m*m - 2*m*|s|
+				const __m128i c_lo = _mm_sub_epi32( q_lo, _mm_slli_epi32( _mm_madd_epi16(m_lo, as_lo), 1 ) );
+				const __m128i c_hi = _mm_sub_epi32( q_hi, _mm_slli_epi32( _mm_madd_epi16(m_hi, as_hi), 1 ) );
+
+				err = e0 + HorizontalSum( _mm_add_epi32(c_lo, c_hi) );
+
+				const __m128i large = _mm_packs_epi16( _mm_packs_epi32(l_lo, l_hi), zero );
+				idx = _mm_or_si128( neg, _mm_and_si128( large, _mm_set1_epi8(1) ) );
+			}
+			else {
+
+				__m128i best_lo = _mm_set1_epi32(INT_MAX);
+				__m128i best_hi = best_lo;
+				__m128i idx_lo = zero;
+				__m128i idx_hi = zero;
+
+				for(int m=0;m<4;m++) {
+
+					__m128i d_lo, d_hi;
+					Dist_SSE2(
+						_mm_sub_epi16( r, _mm_set1_epi16( Clamp(base[0] + mod[m], 0, 255) ) ),
+						_mm_sub_epi16( g, _mm_set1_epi16( Clamp(base[1] + mod[m], 0, 255) ) ),
+						_mm_sub_epi16( b, _mm_set1_epi16( Clamp(base[2] + mod[m], 0, 255) ) ),
+						d_lo, d_hi);
+
+					const __m128i m_lo = _mm_cmplt_epi32(d_lo, best_lo);
+					const __m128i m_hi = _mm_cmplt_epi32(d_hi, best_hi);
+					const __m128i k = _mm_set1_epi32(m);
+
+					best_lo = Select(m_lo, d_lo, best_lo);
+					best_hi = Select(m_hi, d_hi, best_hi);
+					idx_lo  = Select(m_lo, k, idx_lo);
+					idx_hi  = Select(m_hi, k, idx_hi);
+				}
+
+				err = HorizontalSum( _mm_add_epi32(best_lo, best_hi) );
+
+				// indices are 0..3, pack the 8 lanes down to bytes.
+				idx = _mm_packus_epi16( _mm_packs_epi32(idx_lo, idx_hi), zero );
+			}
+
+			if(err < fit.err) {
+				fit.err = err;
+				fit.table = t;
+				_mm_storel_epi64( reinterpret_cast<__m128i *>(fit.idx), idx );
+			}
+		}
+	}
+#endif
+
+	static void FitTables(const SubBlock & s, const int base[3], Fit & fit, Isa isa) {
+
+#if defined(__SSE2__)
+		if(isa == SSE2) {
+			FitTables_SSE2(s, base, fit);
+			return;
+		}
+#endif
+		FitTables_Scalar(s, base, fit);
+	}
+
+	// Search base colours around centre ( quantised to 'bits' ) for the best fit.
+	// When 'limit' is set, only base colours within the differential range of it are allowed.
+	static void SearchBase(const SubBlock & s, const int centre[3], int bits, copy_quality_t quality,
+		const int * limit, int base[3], Fit & fit, Isa isa)
+	{
+		const int max = (1 << bits) - 1;
+		const bool diff = bits == 5;
+
+		fit.err = INT_MAX;
+
+		auto tryBase = [&](int dr, int dg, int db) {
+
+			int q[3] = { centre[0] + dr, centre[1] + dg, centre[2] + db };
+			int e[3];
+
+			for(int c=0;c<3;c++) {
+				q[c] = Clamp(q[c], 0, max);
+				if(limit)
+					q[c] = Clamp(q[c], limit[c] - 4, limit[c] + 3);
+				e[c] = Expand(q[c], diff);
+			}
+
+			Fit f;
+			FitTables(s, e, f, isa);
+
+			if(f.err < fit.err) {
+				fit = f;
+				memcpy(base, q, sizeof q);
+			}
+		};
+
+		tryBase(0, 0, 0);
+
+		if(quality == COPY_QUALITY_MEDIUM) {
+			tryBase( 1, 1, 1);
+			tryBase(-1,-1,-1);
+		}
+		else if(quality == COPY_QUALITY_HIGHEST) {
+			for(int d=-2;d<=2;d++)
+				if(d) tryBase(d, d, d);
+			for(int d=-1;d<=1;d+=2) {
+				tryBase(d, 0, 0);
+				tryBase(0, d, 0);
+				tryBase(0, 0, d);
+			}
+		}
+	}
+
+	static void Gather(const uint32_t px[16], int flip, int sub, SubBlock & s, int avg[3]) {
+
+		const int * pixels = SubPixels(flip, sub);
+
+		avg[0] = avg[1] = avg[2] = 0;
+
+		for(int i=0;i<8;i++) {
+			const uint32_t p = px[pixels[i]];
+			s.r[i] = (p      ) & 0xff;
+			s.g[i] = (p >>  8) & 0xff;
+			s.b[i] = (p >> 16) & 0xff;
+			avg[0] += s.r[i];
+			avg[1] += s.g[i];
+			avg[2] += s.b[i];
+		}
+	}
+
+	// average of 8 pixels quantised to 'bits'.
+	static void Quantise(const int sum[3], int bits, int q[3]) {
+
+		const int max = (1 << bits) - 1;
+
+		for(int c=0;c<3;c++)
+			q[c] = Clamp( (sum[c] * max + 4 * 255) / (8 * 255), 0, max );
+	}
+
+	static void TryFlip(const uint32_t px[16], int flip, copy_quality_t quality, Candidate & best, Isa isa) {
+
+		SubBlock s[2];
+		int sum[2][3];
+
+		Gather(px, flip, 0, s[0], sum[0]);
+		Gather(px, flip, 1, s[1], sum[1]);
+
+		Candidate c;
+		c.flip = flip;
+
+		// individual mode, 4 bits per channel for each sub-block.
+		{
+			c.diff = false;
+
+			int q[3];
+			for(int i=0;i<2;i++) {
+				Quantise(sum[i], 4, q);
+				SearchBase(s[i], q, 4, quality, NULL, c.base[i], c.fit[i], isa);
+			}
+
+			c.err = c.fit[0].err + c.fit[1].err;
+			if(c.err < best.err)
+				best = c;
+		}
+
+		// differential mode, 5 bits per channel and the second within -4..3 of the first.
+		{
+			c.diff = true;
+
+			int q[3];
+			Quantise(sum[0], 5, q);
+			SearchBase(s[0], q, 5, quality, NULL, c.base[0], c.fit[0], isa);
+			Quantise(sum[1], 5, q);
+			SearchBase(s[1], q, 5, quality, c.base[0], c.base[1], c.fit[1], isa);
+
+			c.err = c.fit[0].err + c.fit[1].err;
+			if(c.err < best.err)
+				best = c;
+		}
+	}
+
+	static void Pack(const Candidate & c, unsigned char * out) {
+
+		if(c.diff) {
+			for(int i=0;i<3;i++)
+				out[i] = (c.base[0][i] << 3) | ((c.base[1][i] - c.base[0][i]) & 7);
+		}
+		else {
+			for(int i=0;i<3;i++)
+				out[i] = (c.base[0][i] << 4) | c.base[1][i];
+		}
+
+		out[3] = (c.fit[0].table << 5) | (c.fit[1].table << 2) | (c.diff ? 2 : 0) | (c.flip ? 1 : 0);
+
+		// pixel indices are stored column major, all the MSBs then all the LSBs.
+		uint32_t bits = 0;
+		for(int sub=0;sub<2;sub++) {
+			const int * pixels = SubPixels(c.flip, sub);
+			for(int i=0;i<8;i++) {
+				const int x = pixels[i] & 3;
+				const int y = pixels[i] >> 2;
+				const int k = x * 4 + y;
+				const int idx = c.fit[sub].idx[i];
+				bits |= ((idx >> 1) << (16 + k)) | ((idx & 1) << k);
+			}
+		}
+
+		out[4] = bits >> 24;
+		out[5] = bits >> 16;
+		out[6] = bits >>  8;
+		out[7] = bits;
+	}
+
+public:
+
+	// Encode one block of 16 RGBA pixels (raster order) to 8 bytes.
+	static void EncodeBlock(const uint32_t px[16], unsigned char * out, copy_quality_t quality, Isa isa) {
+
+		Candidate best;
+		best.err = INT_MAX;
+
+		bool flat = true;
+		for(int i=1;i<16 && flat;i++)
+			flat = (px[i] & 0xffffff) == (px[0] & 0xffffff);
+
+		if(flat) {
+
+			// one base colour does for both halves, no flip or mode search.
+			SubBlock s;
+			int sum[3];
+			int q[3];
+
+			Gather(px, 0, 0, s, sum);
+			Quantise(sum, 5, q);
+
+			best.diff = true;
+			best.flip = false;
+			SearchBase(s, q, 5, quality, NULL, best.base[0], best.fit[0], isa);
+			memcpy(best.base[1], best.base[0], sizeof best.base[0]);
+			best.fit[1] = best.fit[0];
+			best.err = 2 * best.fit[0].err;
+		}
+		else {
+			TryFlip(px, 0, quality, best, isa);
+			if(best.err)
+				TryFlip(px, 1, quality, best, isa);
+		}
+
+		Pack(best, out);
+	}
+
+	// Encode a w*h RGBA32 image with 'pitch' bytes per row. Edge blocks repeat the last row / column.
+	static void Encode(void * dst, const void * src, int w, int h, int pitch, copy_quality_t quality, Isa isa = BestIsa()) {
+
+		unsigned char * out = static_cast<unsigned char *>(dst);
+		const unsigned char * in = static_cast<const unsigned char *>(src);
+
+		uint32_t px[16];
+
+		for(int by=0;by<h;by+=4) {
+			for(int bx=0;bx<w;bx+=4) {
+
+				for(int y=0;y<4;y++) {
+					const unsigned char * row = in + pitch * std::min(by+y, h-1);
+					for(int x=0;x<4;x++) {
+						const unsigned char * p = row + 4 * std::min(bx+x, w-1);
+						px[4*y+x] = p[0] | (p[1] << 8) | (p[2] << 16);
+					}
+				}
+
+				EncodeBlock(px, out, quality, isa);
+				out += 8;
+			}
+		}
+	}
+};
@@ -0,0 +1,20 @@
+
+#pragma once
+
+#include <memory>
+
+#include "Image.hpp"
+
+// Where the encoder gets its frames from, in order.
+class FrameSource {
+
+public:
+
+	virtual ~FrameSource() {}
+
+	// the next frame, or an empty pointer once there are no more.
+	virtual std::unique_ptr<Image> NextImage() = 0;
+
+	// true if the frames stopped because the input was bad, rather than at its end.
+	virtual bool Failed() { return false; }
+};
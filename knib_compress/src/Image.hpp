@@ -2,13 +2,22 @@
 #include <libimg.h>
 #include <libimgutil.h>
 #include <cstdarg>
+#include <cstring>
+#include <algorithm>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #pragma once
 
+#include "ImagePool.hpp"
+#include "Dxt1Encoder.hpp"
+#include "Etc1Encoder.hpp"
+
 class Image {
 
 	imgImage * img {nullptr};
+	bool pooled {false};
 
 public:
 	enum open_enum {
@@ -51,6 +60,7 @@ public:
 	Image(Image &&image) {
 
 		this->img = image.img;
+		this->pooled = image.pooled;
 		image.img = NULL;
 	}
 
@@ -80,20 +90,14 @@ public:
 			throw std::runtime_error("Image: out of memory.");
 	}
 
+	// Blank images come from, and go back to, the ImagePool.
 	Image(int w, int h, imgFormat fmt) {
 
-		if( imgAllocImage(&img) == 0) {
-
-			img->width = w;
-			img->height = h;
-			img->format = fmt;
+		img = ImagePool::Instance().Get(w, h, fmt);
+		pooled = true;
 
-			if(imgAllocPixelBuffers(img) == 0)
-				return;
-
-			imgFreeAll(img);
-		}
-		throw std::runtime_error("Image: out of memory.");
+		if(!img)
+			throw std::runtime_error("Image: out of memory.");
 	}
 
 	bool CopyFrom( const Image & image ) {
@@ -105,8 +109,31 @@ public:
 		return CopyFrom(*image);
 	}
 
+	// Use the in-tree texture encoders and colour conversion where there is one, rather than libimgutil.
+	static bool & BuiltinEncoders() {
+
+		static bool builtin = true;
+		return builtin;
+	}
+
 	bool CopyFrom( const Image & image, err_diffuse_kernel_t diffuse_kernel, copy_quality_t quality ) {
 
+		if( BuiltinEncoders() &&
+			Format() == IMG_FMT_DXT1 && image.Format() == IMG_FMT_RGBA32 &&
+			image.Width() == Width() && image.Height() == Height() )
+		{
+			Dxt1Encoder::Encode(Data(0), image.Data(0), Width(), Height(), image.LineSize(0), quality);
+			return true;
+		}
+
+		if( BuiltinEncoders() &&
+			Format() == IMG_FMT_ETC1 && image.Format() == IMG_FMT_RGBA32 &&
+			image.Width() == Width() && image.Height() == Height() )
+		{
+			Etc1Encoder::Encode(Data(0), image.Data(0), Width(), Height(), image.LineSize(0), quality);
+			return true;
+		}
+
 		return imguCopyImage3(img, image.img, diffuse_kernel, quality) == 0;
 	}
 	bool CopyFrom( std::unique_ptr<Image> image, err_diffuse_kernel_t diffuse_kernel, copy_quality_t quality ) {
@@ -114,11 +141,89 @@ public:
 		return CopyFrom(*image, diffuse_kernel, quality);
 	}
 
+	// Texture compress image into this, split into horizontal strips of whole 4x4 block rows
+	//  that are compressed on up to 'threads' threads and stitched back together.
+	// Blocks are compressed independently, so the result is the same as a single CopyFrom.
+	bool CopyFrom( const Image & image, err_diffuse_kernel_t diffuse_kernel, copy_quality_t quality, int threads ) {
+
+		const int block_rows = (Height() + 3) / 4;
+
+		if(threads > block_rows)
+			threads = block_rows;
+
+		if( threads <= 1 ||
+			image.Format() != IMG_FMT_RGBA32 ||
+			(Format() != IMG_FMT_DXT1 && Format() != IMG_FMT_ETC1) ||
+			image.Width() != Width() || image.Height() != Height() )
+			return CopyFrom(image, diffuse_kernel, quality);
+
+		const int block_row_size = LinearSize(0) / block_rows;
+
+		std::vector<std::thread> strip_threads;
+		std::vector<char> strip_ok(threads, 0);
+
+		auto strip = [&](int s) {
+
+			const int y0 = 4 * ((block_rows * s) / threads);
+			const int y1 = std::min( Height(), 4 * ((block_rows * (s+1)) / threads) );
+
+			const char * s_rows = static_cast<const char *>(image.Data(0)) + image.LineSize(0) * y0;
+			char * d_blocks = static_cast<char *>(Data(0)) + block_row_size * (y0 / 4);
+
+			// the in-tree encoders compress the strip where it is.
+			if(BuiltinEncoders()) {
+				if(Format() == IMG_FMT_DXT1)
+					Dxt1Encoder::Encode(d_blocks, s_rows, Width(), y1 - y0, image.LineSize(0), quality);
+				else
+					Etc1Encoder::Encode(d_blocks, s_rows, Width(), y1 - y0, image.LineSize(0), quality);
+				strip_ok[s] = 1;
+				return;
+			}
+
+			// libimgutil only takes whole images, so the strip is copied out, and its blocks back.
+			try {
+				Image src(Width(), y1 - y0, IMG_FMT_RGBA32);
+				Image dst(Width(), y1 - y0, (imgFormat)Format());
+
+				char * d_row = static_cast<char *>(src.Data(0));
+				for(int y=y0;y<y1;y++) {
+					memcpy(d_row, s_rows, src.LineSize(0));
+					s_rows += image.LineSize(0);
+					d_row += src.LineSize(0);
+				}
+
+				if(dst.CopyFrom(src, diffuse_kernel, quality)) {
+					memcpy(d_blocks, dst.Data(0), dst.LinearSize(0));
+					strip_ok[s] = 1;
+				}
+			}
+			catch(...) {}
+		};
+
+		for(int s=1;s<threads;s++)
+			strip_threads.push_back( std::thread( strip, s ) );
+
+		strip(0);
+
+		for(std::thread & thread : strip_threads)
+			thread.join();
+
+		for(int s=0;s<threads;s++)
+			if(!strip_ok[s])
+				return false;
+
+		return true;
+	}
+
 	int Width() const { return img->width; }
 	int Height() const { return img->height; }
+	int LineSize(int channel) const { return img->linesize[channel]; }
 
 	~Image() {
-		imgFreeAll(img);
+		if(pooled)
+			ImagePool::Instance().Put(img);
+		else
+			imgFreeAll(img);
 	}
 
 	int LinearSize(int channel) const {
@@ -0,0 +1,94 @@
+
+#pragma once
+
+#include <libimg.h>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <mutex>
+
+// Recycles image pixel buffers between work sets.
+// Freed images are kept in a bucket per (width, height, format), and handed out again instead
+//  of allocating, so big planes are not malloc'ed, page faulted and freed for every set.
+// Contents of a recycled image are whatever the last user left in it.
+class ImagePool {
+
+	typedef std::tuple<int, int, int> Key;
+	typedef std::map< Key, std::vector<imgImage *> > Buckets;
+
+	Buckets buckets;
+	std::mutex mutex;
+
+	// images kept per bucket, anything beyond that is freed.
+	const size_t max_per_bucket {32};
+
+	ImagePool() {}
+
+	~ImagePool() {
+
+		for(Buckets::iterator it = buckets.begin(); it != buckets.end(); ++it)
+			for(size_t i=0;i<it->second.size();i++)
+				imgFreeAll(it->second[i]);
+	}
+
+public:
+
+	ImagePool(const ImagePool &) = delete;
+
+	static ImagePool & Instance() {
+
+		static ImagePool pool;
+		return pool;
+	}
+
+	// an image with allocated pixel buffers, or NULL.
+	imgImage * Get(int w, int h, imgFormat fmt) {
+
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+
+			Buckets::iterator it = buckets.find( Key(w, h, fmt) );
+
+			if(it != buckets.end() && it->second.size()) {
+				imgImage * img = it->second.back();
+				it->second.pop_back();
+				return img;
+			}
+		}
+
+		imgImage * img = NULL;
+
+		if( imgAllocImage(&img) == 0) {
+
+			img->width = w;
+			img->height = h;
+			img->format = fmt;
+
+			if(imgAllocPixelBuffers(img) == 0)
+				return img;
+
+			imgFreeAll(img);
+		}
+
+		return NULL;
+	}
+
+	void Put(imgImage * img) {
+
+		if(!img)
+			return;
+
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+
+			std::vector<imgImage *> & bucket = buckets[ Key(img->width, img->height, img->format) ];
+
+			if(bucket.size() < max_per_bucket) {
+				bucket.push_back(img);
+				return;
+			}
+		}
+
+		imgFreeAll(img);
+	}
+};
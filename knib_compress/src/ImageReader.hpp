@@ -5,16 +5,24 @@
 #include <vector>
 #include <string>
 #include <atomic>
-#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <condition_variable>
 
-class ImageReader {
+#include "FrameSource.hpp"
+#include "Trace.hpp"
 
-	std::thread thread;
+// Decodes input frames on a pool of reader threads.
+// Frames may finish decoding out of order, NextImage() still returns them in frame order.
+class ImageReader : public FrameSource {
 
-	std::deque<std::unique_ptr<Image> > 	deque;
+	typedef std::vector< std::thread> ThreadVector;
+	typedef std::map< int, std::unique_ptr<Image> > ImageMap;
+
+	ThreadVector 	threadVector;
+
+	ImageMap								images;
 	std::mutex			  					mutex;
 	std::condition_variable 				writable;
 	std::condition_variable 				readable;
@@ -24,38 +32,77 @@ class ImageReader {
 	const int to;
 	const int inc;
 	const int max_frames;
-	bool finished;
+
+	int next_read{0};	// next frame sequence number to be claimed by a reader thread.
+	int next_out{0};	// next frame sequence number to be returned by NextImage().
+	int end{-1};		// first frame sequence number that will never be read, or -1 if unknown.
+	int running{0};
+
+	bool InRange(int frame) const {
+
+		return ((from <= to) && (frame<=to)) ||
+			   ((from  > to) && (frame>=to));
+	}
 
 	void ReadThread() {
 
-		int i = 0;
-		try {
+		Trace::Instance().ThreadName("reader");
 
-			for(i=from;
-				((from <= to) && (i<=to)) ||
-				((from  > to) && (i>=to))  ;
-				i+=inc) {
+		for(;;) {
 
-				std::unique_ptr<Image> image = std::unique_ptr<Image>( new Image( Image::Read, format.c_str(), i ) );
+			int seq;
+			{
+				Trace::Span span("wait for lookahead", "wait");
 
 				std::unique_lock<std::mutex> lock( mutex );
 
-				deque.push_back( std::move(image) );
+				// don't run more than max_frames ahead of the consumer.
+				while( (end < 0 || next_read < end) && (next_read - next_out) >= max_frames )
+					writable.wait( lock );
 
-				readable.notify_one();
+				if(end >= 0 && next_read >= end)
+					break;
 
-				while( deque.size() >= max_frames )
-					writable.wait( lock );
+				seq = next_read++;
+
+				if(!InRange(from + seq * inc)) {
+					if(end < 0 || seq < end)
+						end = seq;
+					break;
+				}
 			}
-		}
-		catch(...) {
-			printf("ERROR: Opening %s frame %d\n", format.c_str(), i);
-		}
-		{
+
+			const int i = from + seq * inc;
+
+			std::unique_ptr<Image> image;
+			try {
+				Trace::Span span("decode", "read", seq / 3);
+				image = std::unique_ptr<Image>( new Image( Image::Read, format.c_str(), i ) );
+			}
+			catch(...) {
+				printf("ERROR: Opening %s frame %d\n", format.c_str(), i);
+			}
+
 			std::unique_lock<std::mutex> lock( mutex );
-			finished = true;
+
+			if(image) {
+				images[seq] = std::move(image);
+				Trace::Instance().Counter("decoded frames", images.size());
+			}
+			else if(end < 0 || seq < end) {
+				// stop at the first frame that fails, discard anything read beyond it.
+				end = seq;
+				images.erase( images.lower_bound(seq), images.end() );
+				writable.notify_all();
+			}
+
 			readable.notify_all();
 		}
+
+		std::unique_lock<std::mutex> lock( mutex );
+		--running;
+		readable.notify_all();
+		writable.notify_all();
 	}
 
 public:
@@ -63,38 +110,58 @@ public:
 	ImageReader(
 		const std::string & format,
 		int from, int to, int inc,
-		int max_frames)
+		int max_frames, int threads = 1)
 	:	format(format),
 	 	from(from),
 	 	to(to),
 	 	inc(inc),
-	 	max_frames(max_frames),
-	 	finished(false)
+	 	max_frames(max_frames > 0 ? max_frames : 1)
 	{
-		thread = std::thread( &ImageReader::ReadThread, this );
+		if(threads < 1)
+			threads = 1;
+
+		running = threads;
+		threadVector.reserve(threads);
+		for(int i=0;i<threads; i++)
+			threadVector.push_back( std::thread( &ImageReader::ReadThread, this ) );
 	}
 
 	~ImageReader() {
 
-		thread.join();
+		{
+			// release any reader still waiting for space.
+			std::unique_lock<std::mutex> lock( mutex );
+			if(end < 0 || end > next_read)
+				end = next_read;
+			writable.notify_all();
+		}
+
+		for(size_t i=0;i<threadVector.size(); i++)
+			threadVector[i].join();
 	}
 
 	std::unique_ptr<Image> NextImage() {
 
 		std::unique_ptr<Image> img;
 
+		Trace::Span span("wait for frame", "wait", next_out / 3);
+
 		std::unique_lock<std::mutex> lock( mutex );
 
-		while( !finished && deque.size()==0 )
+		ImageMap::iterator it;
+
+		while( ((it = images.find(next_out)) == images.end()) &&
+			   !((end >= 0 && next_out >= end) || running == 0) )
 			readable.wait(lock);
 
-		if(deque.size()) {
-			img = std::move(deque.front());
-			deque.pop_front();
-			writable.notify_one();
+		if(it != images.end()) {
+			img = std::move(it->second);
+			images.erase(it);
+			++next_out;
+			Trace::Instance().Counter("decoded frames", images.size());
+			writable.notify_all();
 		}
 
 		return img;
 	}
 };
-
@@ -1,10 +1,21 @@
 
 #pragma once
 
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <stdint.h>
+#include <stdexcept>
+#include "lz4.h"
+#include "lz4hc.h"
+#include "Codec.hpp"
+#include "AsyncWriter.hpp"
+
 struct knib_header {
 
 	char magick[4]; // must be "knib"
-	int version; // must be 0
+	int version; // 0 to 3 ( see 'knib_set_header' )
 	int flags; // see 'knib_header_flags'
 	int orig_width; // width of the input media.
 	int orig_height; // height of the input media.
@@ -14,12 +25,16 @@ struct knib_header {
 	int framerate; // TODO: frames per second, or seconds per frame?
 	int compressed_buffer_size; // size of the buffer required to hold the largest compressed set.
 	int uncompressed_buffer_size; // size of the buffer required to hold the largest uncompressed set.
-	int first_set_offset; // offset of the first 'knib_set_header'
+	int sets; // number of entries in the set index.
+	int64_t first_set_offset; // offset of the first 'knib_set_header'
+	int64_t set_index_offset; // offset of the set index. ( only valid if KNIB_INDEXED is set )
 };
 
 struct knib_set_header {
 
-	int data_offset; // file offset of this sets data.
+	int64_t data_offset; // file offset of this sets data.
+	int64_t next_set_offset; // file offset of the next
+
 	int data_size; // file size of this sets data.
 	int data_uncompressed_size; // size of this sets data once uncompressed.
 
@@ -32,267 +47,398 @@ struct knib_set_header {
 	int a_data_buffer_offset;// 'A' data offset in the uncompressed buffer.
 	int a_data_buffer_size;// 'A' data size in the uncompressed buffer.
 
-	int next_set_offset; // file offset of the next
+	// Each plane is compressed as an independent block.
+	int y_data_compressed_offset; // 'Y' block offset in this sets data.
+	int y_data_compressed_size; // 'Y' block size in this sets data.
+	int cb_data_compressed_offset; // 'Cb' block offset in this sets data.
+	int cb_data_compressed_size; // 'Cb' block size in this sets data.
+	int cr_data_compressed_offset; // 'Cr' block offset in this sets data.
+	int cr_data_compressed_size; // 'Cr' block size in this sets data.
+	int a_data_compressed_offset; // 'A' block offset in this sets data.
+	int a_data_compressed_size; // 'A' block size in this sets data.
+
+	// Version 3 only.
+	int flags; // see 'knib_set_flags'
+	int reserved; // zero.
 };
 
-class KnibFile {
+struct knib_set_index_entry {
 
-	FILE * file {NULL};
+	int64_t set_offset; // file offset of this sets 'knib_set_header'
+	int64_t set_size; // file size of this sets header and data.
+};
 
-	void * compressedbuffer {NULL};
-	int compressedbuffer_size {0};
+// A set of planes, encoded ( and compressed ) by a worker thread, ready to be written by 'KnibFile'.
+class KnibSet {
 
-	void * uncompressedbuffer {NULL};
-	int uncompressedbuffer_size {0};
+	knib_set_header header;
+	void * data {NULL};
+	uint64_t hash;
 
-	knib_header file_header;
+	// FNV-1a, a word at a time. Only used to find candidates for 'SameAs', so speed beats quality.
+	static uint64_t Hash(const void * data, size_t size) {
 
-	void AllocateBuffers(int uncompressed, bool lz4Compressed) {
-
-		int required = 0;
-		if(lz4Compressed) {
-			required = LZ4_compressBound(uncompressed);
-			if(required > compressedbuffer_size) {
-				free(compressedbuffer);
-				if((compressedbuffer = malloc(required)))
-					compressedbuffer_size = required;
-				else
-					compressedbuffer_size = 0;
-			}
-		}
-		if(uncompressed > uncompressedbuffer_size) {
-			free(uncompressedbuffer);
-			if((uncompressedbuffer = malloc(uncompressed)))
-				uncompressedbuffer_size = uncompressed;
-			else
-				uncompressedbuffer_size = 0;
+		const unsigned char * p = static_cast<const unsigned char *>(data);
+		uint64_t h = 14695981039346656037ULL ^ size;
+		uint64_t w;
+
+		for(; size >= sizeof w; size -= sizeof w, p += sizeof w) {
+			memcpy(&w, p, sizeof w);
+			h = (h ^ w) * 1099511628211ULL;
 		}
-		if((compressedbuffer_size < required) || (uncompressedbuffer_size < uncompressed))
-			throw std::runtime_error("out of memory!");
+		for(; size; size--, p++)
+			h = (h ^ *p) * 1099511628211ULL;
+
+		return h;
+	}
+
+	// KNIB_DATA_DICT: the most a plane of 'size' bytes can take, as a chunk size table and its chunks.
+	static int ChunksBound(int size) {
+
+		int bound = 0;
+		for(int offset = 0; offset < size; offset += KNIB_DICT_CHUNK_SIZE)
+			bound += sizeof(int) + LZ4_compressBound(std::min(size - offset, (int)KNIB_DICT_CHUNK_SIZE));
+		return bound;
 	}
 
-	static const char * WhenceStr(int whence) {
+	// KNIB_DATA_DICT: compresses a plane a chunk at a time, each with the same chunk of 'dict' as its prefix.
+	// LZ4 needs the prefix right before the chunk, so each pair is staged together.
+	static int CompressChunks(const char * tex, const char * dict, int size, char * dst) {
 
-		switch(whence) {
-			default: return "???";
-			case SEEK_SET: return "SEEK_SET";
-			case SEEK_CUR: return "SEEK_CUR";
-			case SEEK_END: return "SEEK_END";
+		const int chunks = (size + KNIB_DICT_CHUNK_SIZE - 1) / KNIB_DICT_CHUNK_SIZE;
+		std::vector<char> staged( 2 * KNIB_DICT_CHUNK_SIZE );
+
+		int block = chunks * sizeof(int);
+
+		for(int i=0; i<chunks; i++) {
+
+			const int offset = i * KNIB_DICT_CHUNK_SIZE;
+			const int chunk = std::min(size - offset, (int)KNIB_DICT_CHUNK_SIZE);
+
+			memcpy(&staged[0], dict + offset, chunk);
+			memcpy(&staged[chunk], tex + offset, chunk);
+
+			const int block_size = LZ4_compressHC_usingPrefix(&staged[chunk], dst + block, chunk, chunk);
+			memcpy(dst + i * sizeof(int), &block_size, sizeof block_size);
+
+			block += block_size;
 		}
+
+		return block;
 	}
 
-	void Seek( long offset, int whence ) {
+	// the header, less the file offsets.
+	knib_set_header Layout() const {
 
-	    if( fseek( file, offset, whence ) != 0 ) {
+		knib_set_header layout = header;
+		layout.data_offset = 0;
+		layout.next_set_offset = 0;
+		return layout;
+	}
+
+	// fills in 'data', and the plane layout in 'header'.
+	void Encode(const Codec & codec, const void * const tex[4], const int size[4], const void * const dict[4]) {
+
+		int * const buffer_offset[4] = {
+			&header.y_data_buffer_offset, &header.cb_data_buffer_offset,
+			&header.cr_data_buffer_offset, &header.a_data_buffer_offset };
+		int * const buffer_size[4] = {
+			&header.y_data_buffer_size, &header.cb_data_buffer_size,
+			&header.cr_data_buffer_size, &header.a_data_buffer_size };
+		int * const compressed_offset[4] = {
+			&header.y_data_compressed_offset, &header.cb_data_compressed_offset,
+			&header.cr_data_compressed_offset, &header.a_data_compressed_offset };
+		int * const compressed_size[4] = {
+			&header.y_data_compressed_size, &header.cb_data_compressed_size,
+			&header.cr_data_compressed_size, &header.a_data_compressed_size };
+
+		int uncompressedTextureSize = 0;
+		int compressedBound = 0;
+		for(int i=0; i<4; i++) {
+			uncompressedTextureSize += size[i];
+			if(size[i])
+				compressedBound += dict ? ChunksBound(size[i]) : codec.Bound(size[i]);
+		}
 
-	      printf("oops - bad seek %d %s\n", (int)offset, WhenceStr((int)whence));
-	      throw std::runtime_error("Seek error.");
-	    }
-	  }
+		if(!(data = malloc(compressedBound)) && compressedBound)
+			throw std::runtime_error("out of memory!");
+
+		int uncompressedOffset = 0;
+		int compressedOffset = 0;
+		for(int i=0; i<4; i++) {
+
+			*buffer_offset[i] = uncompressedOffset;
+			*buffer_size[i] = size[i];
+			*compressed_offset[i] = compressedOffset;
+			*compressed_size[i] = 0;
+
+			if(size[i] && tex[i]) {
+				if(dict) {
+					*compressed_size[i] =
+							CompressChunks((const char*)tex[i],
+								(const char*)dict[i],
+								size[i],
+								static_cast<char *>(data) + compressedOffset);
+				}
+				else {
+					*compressed_size[i] =
+							codec.Compress((const char*)tex[i],
+								size[i],
+								static_cast<char *>(data) + compressedOffset);
+				}
+			}
 
-	void Write( const void * data, unsigned int size ) {
+			uncompressedOffset += *buffer_size[i];
+			compressedOffset += *compressed_size[i];
+		}
 
-		if(fwrite(data,size,1,file) != 1)
-			throw std::runtime_error("Write error.");
+		header.data_size = compressedOffset;
+		header.data_uncompressed_size = uncompressedTextureSize;
 	}
 
-	template<typename _T> void Write( const _T & data ) {
+	// encodes the set again with 'cheaper', which decodes faster, and keeps that
+	//  unless it is 'min_ratio' times the size or more. ( see KNIB_SET_DATA_MASK )
+	void TryCheaper(const Codec & cheaper, double min_ratio, const void * const tex[4], const int size[4]) {
+
+		const knib_set_header current = header;
+		void * const current_data = data;
 
-		Write(&data,sizeof data);
+		data = NULL;
+		try {
+			Encode(cheaper, tex, size, NULL);
+		}
+		catch(...) {
+			free(data);
+			data = current_data;
+			header = current;
+			throw;
+		}
+
+		if(header.data_size < min_ratio * current.data_size) {
+			free(current_data);
+			header.flags = (header.flags & ~KNIB_SET_DATA_MASK) | cheaper.Data();
+		}
+		else {
+			free(data);
+			data = current_data;
+			header = current;
+		}
 	}
 
 public:
 
-	KnibFile(const char * fn)
-	{
-		if(!(file = fopen(fn, "wb")))
-			throw std::runtime_error("can't open output file!");
+	// Each plane is compressed by 'codec' as an independent block. 'flags' are the 'knib_set_flags'.
+	// Given 'dict', the planes of the set before, planes are LZ4 compressed in chunks against it. ( KNIB_DATA_DICT )
+	// Sets 'codec' doesn't shrink by its 'MinRatio' fall back to LZ4, then to plain, as they are cheaper to decode.
+	KnibSet(const Codec & codec, const void * const tex[4], const int size[4], int flags = 0, const void * const dict[4] = NULL) {
 
-		memset(&file_header, 0, sizeof file_header);
-		memcpy((void*)file_header.magick, (const void *)"knib", 4);
-		file_header.first_set_offset = sizeof file_header;
+		memset(&header, 0, sizeof header);
+		header.flags = flags;
+
+		Encode(codec, tex, size, dict);
 
-		Write(file_header);
+		// dictionary compressed sets can't stand alone.
+		if(codec.MinRatio() > 0 && codec.Compressed() && !dict) {
+			if(codec.Data() == KNIB_DATA_ZSTD)
+				TryCheaper(Codec(KNIB_DATA_LZ4 | (codec.Shuffled() ? KNIB_DATA_SHUFFLE : 0)), codec.MinRatio(), tex, size);
+			TryCheaper(Codec(KNIB_DATA_PLAIN), codec.MinRatio(), tex, size);
+		}
+
+		hash = Hash(data, header.data_size);
 	}
 
-	~KnibFile() {
+	// An already encoded set, e.g. read back from another file. Takes ownership of the malloc'd 'data'.
+	KnibSet(const knib_set_header & header, void * data)
+		:	header(header),
+		 	data(data),
+		 	hash(Hash(data, header.data_size))
+	{}
+
+	KnibSet(const KnibSet &) = delete;
 
-		free(compressedbuffer);
-		free(uncompressedbuffer);
-		Seek(0, SEEK_SET);
-		Write(file_header);
-		fclose(file);
+	~KnibSet() {
+
+		free(data);
 	}
 
-	void SetFrames(int f) {
+	// 'data_offset' and 'next_set_offset' are filled in by 'KnibFile'.
+	const knib_set_header & Header() const { return header; }
 
-		file_header.frames = f;
+	const void * Data() const { return data; }
+
+	// true if 'other' decodes to exactly the same planes.
+	bool SameAs(const KnibSet & other) const {
+
+		if(hash != other.hash)
+			return false;
+
+		const knib_set_header a = Layout();
+		const knib_set_header b = other.Layout();
+
+		return memcmp(&a, &b, sizeof a) == 0 && memcmp(data, other.data, header.data_size) == 0;
 	}
+};
 
-	void SetFlags(int f) {
+class KnibFile {
 
-		file_header.flags = f;
+	AsyncWriter writer;
+
+	int64_t offset; // where the next set goes.
+
+	knib_header file_header;
+
+	std::vector<knib_set_index_entry> set_index;
+
+	// The last few sets written, and where their data went.
+	// A set that repeats one of them ( a static hold ) is written as a header pointing at the earlier data.
+	struct WrittenSet {
+		std::shared_ptr<const KnibSet> set;
+		int64_t data_offset;
+	};
+	std::deque<WrittenSet> recent_sets;
+	static const int max_recent_sets = 8;
+	int elided_sets {0};
+	int cheaper_sets {0}; // sets not stored as the file says. ( see KNIB_SET_DATA_MASK )
+
+	const WrittenSet * FindRepeat(const KnibSet & encoded) const {
+
+		for(const WrittenSet & written : recent_sets)
+			if(written.set->SameAs(encoded))
+				return &written;
+		return NULL;
 	}
 
-	void SetSize(int w, int h) {
+	// queue a copy of 'data' to be written at 'at'.
+	template<typename _T> void WriteCopy( int64_t at, const _T & data ) {
 
-		file_header.orig_width = w;
-		file_header.frame_width = w;
-		file_header.orig_height = h;
-		file_header.frame_height = h;
+		std::shared_ptr<_T> copy( new _T(data) );
+		writer.Write(at, copy.get(), sizeof data, copy);
 	}
 
-	bool OutputPacked(
-				const void * RGBa0Tex, const int RGBa0Size,
-				const void * RGBa1Tex, const int RGBa1Size,
-				const void * RGBa2Tex, const int RGBa2Size,
-				const void * A012Tex,  const int A012Size) {
+	void WriteSetIndex() {
 
-		if(A012Size && A012Tex)
-			file_header.flags |= KNIB_ALPHA;
+		if(set_index.empty())
+			return;
 
-		if(RGBa0Tex) OutputPackedPart( RGBa0Tex, RGBa0Size, A012Tex, A012Size );
-		if(RGBa1Tex) OutputPackedPart( RGBa1Tex, RGBa1Size, nullptr, 0 );
-		if(RGBa2Tex) OutputPackedPart( RGBa2Tex, RGBa2Size, nullptr, 0 );
+		file_header.set_index_offset = offset;
+		file_header.sets = set_index.size();
+		file_header.flags |= KNIB_INDEXED;
 
-		return true;
+		std::shared_ptr<std::vector<knib_set_index_entry> > index( new std::vector<knib_set_index_entry>(set_index) );
+		writer.Write(offset, &(*index)[0], index->size() * sizeof(knib_set_index_entry), index);
+		offset += index->size() * sizeof(knib_set_index_entry);
 	}
-private:
 
-	bool OutputPackedPart( const void * RGBTex, const int RGBSize, const void * ATex, const int ASize) {
+public:
 
-		const int uncompressedTextureSize = RGBSize + ASize;
-		int compressedSize = uncompressedTextureSize;
+	// 'max_in_flight' set writes may be outstanding before 'OutputSet' blocks.
+	KnibFile(const char * fn, int max_in_flight = 8)
+		:	writer(fn, 2 * max_in_flight) // a header and data write per set.
+	{
+		memset(&file_header, 0, sizeof file_header);
+		memcpy((void*)file_header.magick, (const void *)"knib", 4);
+		file_header.version = 3;
+		file_header.first_set_offset = sizeof file_header;
 
-		AllocateBuffers(uncompressedTextureSize,((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4));
+		offset = sizeof file_header;
+	}
 
-		const void * useUncompressedBuffer = NULL;
+	~KnibFile() {
 
-		if(ASize) {
+		try {
+			WriteSetIndex();
+			WriteCopy(0, file_header);
+		}
+		catch(const std::exception & e) {
+			printf("ERROR: %s\n", e.what());
+		}
 
-			char * unc_buff = static_cast<char *>(uncompressedbuffer);
-			memcpy(unc_buff, RGBTex, RGBSize ); unc_buff += RGBSize;
-			memcpy(unc_buff, ATex, ASize);
+		if(elided_sets)
+			printf("%d repeated sets stored by reference.\n", elided_sets);
 
-			useUncompressedBuffer = uncompressedbuffer;
+		if(cheaper_sets)
+			printf("%d sets stored the cheaper to decode way, compression didn't pay.\n", cheaper_sets);
 
-			if((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4) {
+		if(!writer.Close())
+			printf("ERROR: failed to write output file.\n");
+	}
 
-				compressedSize =
-						LZ4_compressHC((const char*)uncompressedbuffer,
-							(char*)compressedbuffer,
-							uncompressedTextureSize);
-			}
-		}
-		else {
+	void SetFrames(int f) {
 
-			useUncompressedBuffer = RGBTex;
+		file_header.frames = f;
+	}
 
-			if((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4) {
-				compressedSize =
-						LZ4_compressHC((const char*)RGBTex,
-							(char*)compressedbuffer,
-							uncompressedTextureSize);
-			}
-		}
+	void SetFlags(int f) {
 
-		knib_set_header set;
-		memset(&set, 0, sizeof set);
-
-		set.data_offset = ftell(file) + sizeof(set);
-		set.data_size = compressedSize;
-		set.data_uncompressed_size = uncompressedTextureSize;
-		set.y_data_buffer_offset = 0;
-		set.y_data_buffer_size = RGBSize;
-		set.cb_data_buffer_offset = 0;
-		set.cb_data_buffer_size = 0;
-		set.cr_data_buffer_offset = 0;
-		set.cr_data_buffer_size = 0;
-		set.a_data_buffer_offset = RGBSize;
-		set.a_data_buffer_size = ASize;
-		set.next_set_offset = set.data_offset + set.data_size;
-
-		printf("writing set @ %ld, next set @ %d\n",ftell(file), set.next_set_offset);
-		Write(set);
-		if((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4)
-			Write(compressedbuffer, set.data_size);
-		else
-			Write(useUncompressedBuffer, set.data_size);
+		file_header.flags = f;
+	}
 
-		if(set.data_size > file_header.compressed_buffer_size)
-			file_header.compressed_buffer_size = set.data_size;
+	void SetSize(int w, int h) {
 
-		if((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4)
-			if(set.data_uncompressed_size > file_header.uncompressed_buffer_size)
-				file_header.uncompressed_buffer_size = set.data_uncompressed_size;
+		file_header.orig_width = w;
+		file_header.frame_width = w;
+		file_header.orig_height = h;
+		file_header.frame_height = h;
+	}
 
-		return true;
+	// Hint at the final file size, so the file system can allocate it in one go.
+	void Reserve(int64_t size) {
+
+		writer.Reserve(size);
 	}
 
-public:
+	// Queues a set encoded by a worker thread for writing. Sets must be output in order.
+	// The set is kept alive until its data is on disk.
+	// A set identical to a recent one only gets a header, its 'data_offset' refers to the earlier sets data.
+	// ( readers see the same 'data_offset' twice, and can skip decoding and uploading it again )
+	bool OutputSet( std::shared_ptr<const KnibSet> encoded ) {
 
-	bool OutputPlanar(
-				 const void * YTex,  const int YSize,
-				 const void * CbTex, const int CbSize,
-				 const void * CrTex, const int CrSize,
-				 const void * ATex,  const int ASize ) {
+		knib_set_header set = encoded->Header();
 
-		if(ASize && ATex)
+		if(set.a_data_buffer_size)
 			file_header.flags |= KNIB_ALPHA;
 
-		const int uncompressedTextureSize = YSize+CbSize+CrSize+ASize;
+		if(set.flags & KNIB_SET_DATA_MASK)
+			cheaper_sets++;
 
-		AllocateBuffers(uncompressedTextureSize,((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4));
+		const WrittenSet * repeat = FindRepeat(*encoded);
 
-		{
-			char * unc_buff = static_cast<char *>(uncompressedbuffer);
-			memcpy(unc_buff,  YTex, YSize ); unc_buff += YSize;
-			memcpy(unc_buff, CbTex, CbSize); unc_buff += CbSize;
-			memcpy(unc_buff, CrTex, CrSize); unc_buff += CrSize;
-			memcpy(unc_buff,  ATex, ASize );
+		if(repeat) {
+			set.data_offset = repeat->data_offset;
+			set.next_set_offset = offset + sizeof(set);
+			elided_sets++;
+			printf("writing set @ %lld, repeats data @ %lld\n", (long long)offset, (long long)set.data_offset);
+		}
+		else {
+			set.data_offset = offset + sizeof(set);
+			set.next_set_offset = set.data_offset + set.data_size;
+			printf("writing set @ %lld, next set @ %lld\n", (long long)offset, (long long)set.next_set_offset);
 		}
 
-		int compressedSize = uncompressedTextureSize;
+		knib_set_index_entry entry;
+		entry.set_offset = offset;
+		entry.set_size = set.next_set_offset - offset;
+		set_index.push_back(entry);
 
-		if((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4) {
-			compressedSize =
-					LZ4_compressHC((const char*)uncompressedbuffer,
-						(char*)compressedbuffer,
-						uncompressedTextureSize);
-		}
+		WriteCopy(offset, set);
+		if(!repeat) {
+			writer.Write(set.data_offset, encoded->Data(), set.data_size, encoded);
 
-		knib_set_header set;
-		memset(&set, 0, sizeof set);
-
-		set.data_offset = ftell(file) + sizeof(set);
-		set.data_size = compressedSize;
-		set.data_uncompressed_size = uncompressedTextureSize;
-		set.y_data_buffer_offset = 0;
-		set.y_data_buffer_size = YSize;
-		set.cb_data_buffer_offset = YSize;
-		set.cb_data_buffer_size = CbSize;
-		set.cr_data_buffer_offset = YSize+CbSize;
-		set.cr_data_buffer_size = CrSize;
-		set.a_data_buffer_offset = YSize+CbSize+CrSize;
-		set.a_data_buffer_size = ASize;
-		set.next_set_offset = set.data_offset + set.data_size;
-
-		printf("writing set @ %ld, next set @ %d\n",ftell(file), set.next_set_offset);
-		Write(set);
-		if((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4)
-			Write(compressedbuffer, set.data_size);
-		else
-			Write(uncompressedbuffer, set.data_size);
+			recent_sets.push_front( WrittenSet { encoded, set.data_offset } );
+			if(recent_sets.size() > max_recent_sets)
+				recent_sets.pop_back();
+		}
+		offset = set.next_set_offset;
 
 		if(set.data_size > file_header.compressed_buffer_size)
 			file_header.compressed_buffer_size = set.data_size;
 
-		if((file_header.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4)
+		// readers rebuild delta sets in a buffer of this size, even if they aren't compressed.
+		if(Codec::Compressed(file_header.flags) || (file_header.flags & (KNIB_DATA_DELTA | KNIB_DATA_DICT)))
 			if(set.data_uncompressed_size > file_header.uncompressed_buffer_size)
 				file_header.uncompressed_buffer_size = set.data_uncompressed_size;
 
 		return true;
 	}
-
 };
 
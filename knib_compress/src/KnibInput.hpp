@@ -0,0 +1,95 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <memory>
+#include <stdexcept>
+
+#include "KnibFile.hpp"
+
+// Reads the sets of one version 2 or 3 Knib file, following the next_set_offset chain.
+class KnibInput {
+
+	FILE * file {NULL};
+	knib_header header;
+	int64_t next_set_offset;
+	int sets_read {0};
+
+	void Read(int64_t offset, void * data, size_t size) {
+
+		if( fseeko(file, (off_t)offset, SEEK_SET) != 0 || (size && fread(data, size, 1, file) != 1) )
+			throw std::runtime_error("Read error.");
+	}
+
+public:
+
+	KnibInput(const char * fn) {
+
+		if(!(file = fopen(fn, "rb")))
+			throw std::runtime_error("can't open input file!");
+
+		try {
+			Read(0, &header, sizeof header);
+		}
+		catch(...) {
+			fclose(file);
+			throw;
+		}
+
+		if(memcmp(header.magick, "knib", 4) != 0 || header.version < 2 || header.version > 3) {
+			fclose(file);
+			throw std::runtime_error("not a version 2 or 3 Knib file!");
+		}
+
+		next_set_offset = header.first_set_offset;
+	}
+
+	KnibInput(const KnibInput &) = delete;
+
+	~KnibInput() {
+
+		fclose(file);
+	}
+
+	const knib_header & Header() const { return header; }
+
+	// The next set, or an empty pointer after the last.
+	std::shared_ptr<KnibSet> NextSet() {
+
+		// old un-indexed files don't say how many sets they hold, they end with the file.
+		if( (header.flags & KNIB_INDEXED) ? sets_read >= header.sets : next_set_offset >= FileSize() )
+			return nullptr;
+
+		// version 2 set headers are a prefix of version 3.
+		knib_set_header set;
+		memset(&set, 0, sizeof set);
+		Read(next_set_offset, &set, header.version == 2 ? offsetof(knib_set_header, flags) : sizeof set);
+
+		void * data = malloc(set.data_size ? set.data_size : 1);
+		if(!data)
+			throw std::runtime_error("out of memory!");
+
+		try {
+			Read(set.data_offset, data, set.data_size);
+		}
+		catch(...) {
+			free(data);
+			throw;
+		}
+
+		next_set_offset = set.next_set_offset;
+		sets_read++;
+
+		return std::shared_ptr<KnibSet>( new KnibSet(set, data) );
+	}
+
+	int64_t FileSize() {
+
+		if( fseeko(file, 0, SEEK_END) != 0 )
+			throw std::runtime_error("Seek error.");
+		return ftello(file);
+	}
+};
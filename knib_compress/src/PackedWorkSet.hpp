@@ -3,17 +3,25 @@
 
 #include <memory>
 
+#include "KnibFile.hpp"
+#include "Trace.hpp"
+#include "RateControl.hpp"
+
 class PackedWorkSet {
 
 	int w;
 	int h;
 	bool alpha;
-	bool do_lz4;
+	Codec codec;
 	imgFormat textureFmt;
 
 	const int set_index;
 
 	copy_quality_t quality;
+	int strip_threads;
+
+	// sets bigger than this are encoded again at a lower quality, 0 for no limit.
+	int max_set_size;
 
 	std::unique_ptr<Image> RGBa0;
 	std::unique_ptr<Image> RGBa1;
@@ -29,6 +37,8 @@ class PackedWorkSet {
 	std::unique_ptr<Image> work_input_img1;
 	std::unique_ptr<Image> work_input_img2;
 
+	std::vector<std::unique_ptr<KnibSet> > encoded;
+
 	void Dispose() {
 
 	}
@@ -55,21 +65,28 @@ class PackedWorkSet {
 		}
 	}
 
-	bool DoTextureCompression() {
+	bool Compress(Image & dst, const Image & src, copy_quality_t quality, const char * span_name) {
+
+		Trace::Span span(span_name, "texture", set_index);
+
+		return dst.CopyFrom( src,ERR_DIFFUSE_KERNEL_DEFAULT,quality,strip_threads);
+	}
+
+	bool DoTextureCompression(copy_quality_t quality) {
 
-		if(RGBa0 && !compressedRGB0->CopyFrom( *RGBa0,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(RGBa0 && !Compress( *compressedRGB0, *RGBa0, quality, "compress RGB0" )) {
 			printf("Error compressing RGB0\n");
 			goto err;
 		}
-		if(RGBa1 && !compressedRGB1->CopyFrom( *RGBa1,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(RGBa1 && !Compress( *compressedRGB1, *RGBa1, quality, "compress RGB1" )) {
 			printf("Error compressing RGB1\n");
 			goto err;
 		}
-		if(RGBa2 && !compressedRGB2->CopyFrom( *RGBa2,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(RGBa2 && !Compress( *compressedRGB2, *RGBa2, quality, "compress RGB2" )) {
 			printf("Error compressing RGB2\n");
 			goto err;
 		}
-		if(A012 && !compressedA012->CopyFrom( *A012,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(A012 && !Compress( *compressedA012, *A012, quality, "compress A012" )) {
 			printf("Error compressing A012\n");
 			goto err;
 		}
@@ -82,14 +99,46 @@ class PackedWorkSet {
 		return false;
 	}
 
+	void EncodeSet(const std::unique_ptr<Image> & RGB, const std::unique_ptr<Image> & A) {
+
+		if(!RGB)
+			return;
+
+		const void * tex[4] = { RGB->Data(0), NULL, NULL, A ? A->Data(0) : NULL };
+		const int size[4] = { RGB->LinearSize(0), 0, 0, A ? A->LinearSize(0) : 0 };
+
+		Trace::Span span(codec.Name(), "encode", set_index);
+
+		encoded.push_back( std::unique_ptr<KnibSet>( new KnibSet(codec, tex, size) ) );
+	}
+
+	// compress the textures here on the worker thread, the writer only has to output them.
+	// Each frame is its own set, the first set carries the alpha of all 3.
+	void EncodeSets() {
+
+		EncodeSet(compressedRGB0, compressedA012);
+		EncodeSet(compressedRGB1, nullptr);
+		EncodeSet(compressedRGB2, nullptr);
+	}
+
+	int LargestSet() const {
+
+		int size = 0;
+		for(const std::unique_ptr<KnibSet> & set : encoded)
+			size = std::max(size, set->Header().data_size);
+		return size;
+	}
+
 public:
 
-	PackedWorkSet(std::vector<std::unique_ptr<Image> > &images, int w, int h, bool alpha, bool do_lz4, imgFormat textureFmt, copy_quality_t quality, int set_index)
+	PackedWorkSet(std::vector<std::unique_ptr<Image> > &images, int w, int h, bool alpha, const Codec & codec, imgFormat textureFmt, copy_quality_t quality, int strip_threads, int max_set_size, int set_index)
 		:	w(w), h(h),
 		 	alpha(alpha),
-		 	do_lz4(do_lz4),
+		 	codec(codec),
 		 	textureFmt(textureFmt),
 			quality(quality),
+			strip_threads(strip_threads),
+			max_set_size(max_set_size),
 		 	set_index(set_index)
 	{
 		if(images[0])
@@ -109,8 +158,22 @@ public:
 		return set_index;
 	}
 
+	// false if the sets couldn't be encoded, or not within --max-set-size.
 	bool Work() {
 
+		try {
+			return Encode();
+		}
+		catch(const std::exception & e) {
+			printf("set %d: %s\n", set_index, e.what());
+			return false;
+		}
+	}
+
+	bool Encode() {
+
+		Trace::Span span("encode set", "encode", set_index);
+
 		std::vector<std::unique_ptr<Image> > images;
 		images.push_back( std::move(work_input_img0) );
 		images.push_back( std::move(work_input_img1) );
@@ -134,41 +197,68 @@ public:
 		if(alpha)
 			compressedA012 = std::unique_ptr<Image>( new Image(w, h, textureFmt) );
 
-		if(images[0])
-			if(RGBa0->CopyFrom( *images[0] ) == false)
-				return false;
-		if(images[1])
-			if(RGBa1->CopyFrom( *images[1] ) == false)
-				return false;
-		if(images[2])
-			if(RGBa2->CopyFrom( *images[2] ) == false)
-				return false;
-
-		if(alpha) {
-			memset( A012->Data(0), 0xff, A012->LinearSize(0) );
-			if(RGBa0) MoveAlphaToChannel(*A012, *RGBa0, 0);
-			if(RGBa1) MoveAlphaToChannel(*A012, *RGBa1, 1);
-			if(RGBa2) MoveAlphaToChannel(*A012, *RGBa2, 2);
+		{
+			Trace::Span span("convert", "encode", set_index);
+
+			if(images[0])
+				if(RGBa0->CopyFrom( *images[0] ) == false)
+					return false;
+			if(images[1])
+				if(RGBa1->CopyFrom( *images[1] ) == false)
+					return false;
+			if(images[2])
+				if(RGBa2->CopyFrom( *images[2] ) == false)
+					return false;
+
+			if(alpha) {
+				memset( A012->Data(0), 0xff, A012->LinearSize(0) );
+				if(RGBa0) MoveAlphaToChannel(*A012, *RGBa0, 0);
+				if(RGBa1) MoveAlphaToChannel(*A012, *RGBa1, 1);
+				if(RGBa2) MoveAlphaToChannel(*A012, *RGBa2, 2);
+			}
 		}
 
-		bool ret = DoTextureCompression();
+		// packed sets only have one quality to lower, skip the chroma only levels.
+		const std::vector<RateControl::Level> ladder = RateControl::Ladder(quality);
+
+		bool ret;
+		for(int level=0;;) {
+
+			encoded.clear();
+
+			if(!(ret = DoTextureCompression(ladder[level].luma)))
+				break;
+
+			EncodeSets();
+
+			if(!max_set_size || LargestSet() <= max_set_size)
+				break;
+
+			// only levels with a cheaper luma make a packed set any smaller.
+			const copy_quality_t tried = ladder[level].luma;
+			while((size_t)level < ladder.size() && ladder[level].luma >= tried)
+				++level;
+
+			if((size_t)level == ladder.size()) {
+				printf("set %d is %d bytes at the lowest quality, over --max-set-size\n", set_index, LargestSet());
+				ret = false;
+				break;
+			}
+		}
 
 		RGBa0.reset();
 		RGBa1.reset();
 		RGBa2.reset();
 		A012.reset();
+		compressedRGB0.reset();
+		compressedRGB1.reset();
+		compressedRGB2.reset();
+		compressedA012.reset();
 
 		return ret;
 	}
 
-	void * RGB0Data() const { return compressedRGB0 ? compressedRGB0->Data(0) : NULL; }
-	void * RGB1Data() const { return compressedRGB1 ? compressedRGB1->Data(0) : NULL; }
-	void * RGB2Data() const { return compressedRGB2 ? compressedRGB2->Data(0) : NULL; }
-	void * A012Data() const { return compressedA012 ? compressedA012->Data(0) : NULL; }
-
-	int    RGB0Size() const { return compressedRGB0 ? compressedRGB0->LinearSize(0) : 0; }
-	int    RGB1Size() const { return compressedRGB1 ? compressedRGB1->LinearSize(0) : 0; }
-	int    RGB2Size() const { return compressedRGB2 ? compressedRGB2->LinearSize(0) : 0; }
-	int    A012Size() const { return compressedA012 ? compressedA012->LinearSize(0) : 0; }
+	// hands the encoded sets over to the writer, which keeps them until they're on disk.
+	std::vector<std::unique_ptr<KnibSet> > ReleaseEncodedSets() { return std::move(encoded); }
 };
 
@@ -0,0 +1,338 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <algorithm>
+
+#include "FrameSource.hpp"
+#include "Trace.hpp"
+
+// Reads a stream of frames from stdin ( "-" ), a file or a FIFO, on its own thread.
+// Either YUV4MPEG2 4:2:0, which is read as YUV420P images and skips colour conversion,
+//  or headerless RGBA32 frames of a given size.
+// Frames are read with large sequential reads straight into pooled images, and at most
+//  'max_frames' are read ahead of the consumer.
+class PipeReader : public FrameSource {
+
+	int fd {-1};
+	bool close_fd {false};
+
+	const bool y4m;
+	int w;
+	int h;
+	imgFormat format;
+
+	// small reads, like the Y4M headers, are buffered.
+	std::vector<char> buffer;
+	size_t pos {0};
+	size_t len {0};
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable readable;
+	std::condition_variable writable;
+
+	std::deque<std::unique_ptr<Image> > frames;
+	const int max_frames;
+	bool end {false};
+	bool failed {false}; // see 'Failed'
+	bool quit {false};
+
+	// false at end of stream, throws on a read error.
+	bool Fill() {
+
+		pos = 0;
+		len = 0;
+
+		for(;;) {
+			const ssize_t n = read(fd, &buffer[0], buffer.size());
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n < 0)
+				throw std::runtime_error(std::string("PipeReader: ") + strerror(errno));
+			if(n == 0)
+				return false;
+			len = n;
+			return true;
+		}
+	}
+
+	int GetC() {
+
+		if(pos == len && !Fill())
+			return EOF;
+		return (unsigned char)buffer[pos++];
+	}
+
+	// reads up to, and discards, the next '\n'. false at end of stream, throws if it ends mid line.
+	bool ReadLine(std::string & line) {
+
+		line.clear();
+
+		int c;
+		while((c = GetC()) != EOF) {
+			if(c == '\n')
+				return true;
+			line += (char)c;
+		}
+		if(!line.empty())
+			throw std::runtime_error("PipeReader: truncated YUV4MPEG2 header.");
+		return false;
+	}
+
+	bool Read(void * dst, size_t size) {
+
+		char * d = static_cast<char *>(dst);
+
+		size_t n = std::min(size, len - pos);
+		memcpy(d, &buffer[pos], n);
+		pos += n;
+		d += n;
+		size -= n;
+
+		// anything at least as big as the buffer goes straight to its destination.
+		while(size >= buffer.size()) {
+			const ssize_t r = read(fd, d, size);
+			if(r < 0 && errno == EINTR)
+				continue;
+			if(r < 0)
+				throw std::runtime_error(std::string("PipeReader: ") + strerror(errno));
+			if(r == 0)
+				return false;
+			d += r;
+			size -= r;
+		}
+
+		while(size) {
+			if(pos == len && !Fill())
+				return false;
+			n = std::min(size, len - pos);
+			memcpy(d, &buffer[pos], n);
+			pos += n;
+			d += n;
+			size -= n;
+		}
+
+		return true;
+	}
+
+	bool ReadPlane(Image & image, int ch, int width, int height, int bpp) {
+
+		char * d = static_cast<char *>(image.Data(ch));
+		const int row = width * bpp;
+
+		if(image.LineSize(ch) == row)
+			return Read(d, (size_t)row * height);
+
+		for(int y=0;y<height;y++, d += image.LineSize(ch))
+			if(!Read(d, row))
+				return false;
+
+		return true;
+	}
+
+	void ReadHeader() {
+
+		std::string line;
+
+		if(!ReadLine(line) || line.compare(0, 10, "YUV4MPEG2 ") != 0)
+			throw std::runtime_error("PipeReader: not a YUV4MPEG2 stream.");
+
+		w = h = 0;
+
+		size_t i = 10;
+		while(i < line.size()) {
+
+			size_t j = line.find(' ', i);
+			if(j == std::string::npos)
+				j = line.size();
+
+			const std::string tag = line.substr(i, j - i);
+
+			if(!tag.empty()) {
+				switch(tag[0]) {
+				case 'W': w = atoi(tag.c_str() + 1); break;
+				case 'H': h = atoi(tag.c_str() + 1); break;
+				case 'C':
+					// 8 bit 4:2:0, the chroma siting doesn't change the planes.
+					if(tag != "C420" && tag != "C420jpeg" && tag != "C420paldv" && tag != "C420mpeg2")
+						throw std::runtime_error("PipeReader: only 8 bit 4:2:0 Y4M is supported.");
+					break;
+				}
+			}
+
+			i = j + 1;
+		}
+
+		if(w <= 0 || h <= 0)
+			throw std::runtime_error("PipeReader: bad YUV4MPEG2 header.");
+	}
+
+	// the next frame, or an empty pointer at the end of the stream. Throws on bad or truncated frames.
+	std::unique_ptr<Image> ReadFrame() {
+
+		if(y4m) {
+			std::string line;
+			if(!ReadLine(line))
+				return nullptr;
+			if(line.compare(0, 5, "FRAME") != 0)
+				throw std::runtime_error("PipeReader: bad YUV4MPEG2 frame header.");
+		}
+		else if(pos == len && !Fill())
+			return nullptr;
+
+		std::unique_ptr<Image> image( new Image(w, h, format) );
+
+		bool ok;
+		if(y4m)
+			ok = ReadPlane(*image, 0, w, h, 1) &&
+				 ReadPlane(*image, 1, (w+1)/2, (h+1)/2, 1) &&
+				 ReadPlane(*image, 2, (w+1)/2, (h+1)/2, 1);
+		else
+			ok = ReadPlane(*image, 0, w, h, 4);
+
+		if(!ok)
+			throw std::runtime_error("PipeReader: truncated frame on input.");
+
+		return image;
+	}
+
+	void ReadThread() {
+
+		Trace::Instance().ThreadName("pipe");
+
+		for(int seq=0;;seq++) {
+
+			{
+				Trace::Span span("wait for lookahead", "wait");
+
+				std::unique_lock<std::mutex> lock( mutex );
+
+				while( !quit && frames.size() >= (size_t)max_frames )
+					writable.wait( lock );
+
+				if(quit)
+					break;
+			}
+
+			std::unique_ptr<Image> image;
+			bool error = false;
+			try {
+				Trace::Span span("read", "read", seq / 3);
+				image = ReadFrame();
+			}
+			catch(const std::exception & e) {
+				printf("ERROR: %s\n", e.what());
+				error = true;
+			}
+
+			std::unique_lock<std::mutex> lock( mutex );
+
+			failed = error;
+
+			if(!image)
+				break;
+
+			frames.push_back( std::move(image) );
+			Trace::Instance().Counter("decoded frames", frames.size());
+			readable.notify_all();
+		}
+
+		std::unique_lock<std::mutex> lock( mutex );
+		end = true;
+		readable.notify_all();
+	}
+
+public:
+
+	// 'w' and 'h' give the frame size of raw RGBA input, Y4M streams carry their own.
+	PipeReader(const char * path, bool y4m, int w, int h, int max_frames)
+		:	y4m(y4m),
+		 	w(w),
+		 	h(h),
+		 	format(y4m ? IMG_FMT_YUV420P : IMG_FMT_RGBA32),
+		 	buffer(1 << 20),
+		 	max_frames(max_frames > 0 ? max_frames : 1)
+	{
+		if(strcmp(path, "-") == 0)
+			fd = 0;
+		else if((fd = open(path, O_RDONLY)) >= 0)
+			close_fd = true;
+		else
+			throw std::runtime_error("PipeReader: can't open input.");
+
+		try {
+			if(y4m)
+				ReadHeader();
+			else if(w <= 0 || h <= 0)
+				throw std::runtime_error("PipeReader: raw RGBA input needs a frame size.");
+		}
+		catch(...) {
+			if(close_fd)
+				close(fd);
+			throw;
+		}
+
+		thread = std::thread( &PipeReader::ReadThread, this );
+	}
+
+	// NOTE: blocks until the reader thread's current read() returns.
+	~PipeReader() {
+
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			quit = true;
+			writable.notify_all();
+		}
+
+		thread.join();
+
+		if(close_fd)
+			close(fd);
+	}
+
+	int Width() const { return w; }
+	int Height() const { return h; }
+	imgFormat Format() const { return format; }
+
+	std::unique_ptr<Image> NextImage() {
+
+		std::unique_ptr<Image> img;
+
+		Trace::Span span("wait for frame", "wait");
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		while( frames.empty() && !end )
+			readable.wait( lock );
+
+		if(!frames.empty()) {
+			img = std::move(frames.front());
+			frames.pop_front();
+			Trace::Instance().Counter("decoded frames", frames.size());
+			writable.notify_all();
+		}
+
+		return img;
+	}
+
+	bool Failed() {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		return failed;
+	}
+};
@@ -3,17 +3,35 @@
 
 #include <memory>
 
+#include "KnibFile.hpp"
+#include "ColourConverter.hpp"
+#include "Trace.hpp"
+#include "RateControl.hpp"
+#include "DeltaChain.hpp"
+
 class PlanarWorkSet {
 
 	int w;
 	int h;
 	bool alpha;
-	bool do_lz4;
+	Codec codec;
 	imgFormat textureFmt;
 
 	const int set_index;
 
 	copy_quality_t quality;
+	int strip_threads;
+
+	// with a target bitrate, the quality of each set is chosen here.
+	std::shared_ptr<RateControl> rate;
+	copy_quality_t luma_quality;
+	copy_quality_t chroma_quality;
+
+	// sets bigger than this are encoded again further down the quality ladder, 0 for no limit.
+	int max_set_size;
+
+	// with KNIB_DATA_DELTA, the set before hands its planes on here.
+	std::shared_ptr<DeltaChain> delta;
 
 	std::unique_ptr<Image> Y;
 	std::unique_ptr<Image> Cb;
@@ -29,25 +47,34 @@ class PlanarWorkSet {
 	std::unique_ptr<Image> work_input_img1;
 	std::unique_ptr<Image> work_input_img2;
 
+	std::unique_ptr<KnibSet> encoded;
+
 	void Dispose() {
 
 	}
 
+	bool Compress(Image & dst, const Image & src, copy_quality_t quality, const char * span_name) {
+
+		Trace::Span span(span_name, "texture", set_index);
+
+		return dst.CopyFrom( src,ERR_DIFFUSE_KERNEL_DEFAULT,quality,strip_threads);
+	}
+
 	bool DoTextureCompression() {
 
-		if(!compressedY->CopyFrom( *Y,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(!Compress( *compressedY, *Y, luma_quality, "compress Y" )) {
 			printf("Error compressing Y\n");
 			goto err;
 		}
-		if(!compressedCb->CopyFrom( *Cb,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(!Compress( *compressedCb, *Cb, chroma_quality, "compress Cb" )) {
 			printf("Error compressing Cb\n");
 			goto err;
 		}
-		if(!compressedCr->CopyFrom( *Cr,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(!Compress( *compressedCr, *Cr, chroma_quality, "compress Cr" )) {
 			printf("Error compressing Cr\n");
 			goto err;
 		}
-		if(A && !compressedA->CopyFrom( *A,ERR_DIFFUSE_KERNEL_DEFAULT,quality)) {
+		if(A && !Compress( *compressedA, *A, luma_quality, "compress A" )) {
 			printf("Error compressing A\n");
 			goto err;
 		}
@@ -62,6 +89,14 @@ class PlanarWorkSet {
 
 	bool ConvertToYCbCrA(std::unique_ptr<Image> src, imgFormat fmt, int index) {
 
+		// already YCbCr, nothing to convert.
+		if(ColourConverter::FromYCbCrA420(*src, *Y, *Cb, *Cr, A.get(), index))
+			return true;
+
+		// straight into the interleaved planes, when we can.
+		if(Image::BuiltinEncoders() && ColourConverter::ToYCbCrA420(*src, *Y, *Cb, *Cr, A.get(), index))
+			return true;
+
 		std::unique_ptr<Image> planar = std::unique_ptr<Image>(
 			new Image(src->Width(), src->Height(), fmt));
 
@@ -119,6 +154,92 @@ class PlanarWorkSet {
 		return true;
 	}
 
+	// the texture compressed planes, as the set after this one sees them. ( see 'DeltaChain' )
+	std::shared_ptr<const DeltaChain::Planes> GatherPlanes() const {
+
+		const Image * tex[4] = { compressedY.get(), compressedCb.get(), compressedCr.get(), compressedA.get() };
+
+		std::shared_ptr<DeltaChain::Planes> planes( new DeltaChain::Planes );
+
+		for(const Image * t : tex)
+			if(t) {
+				const char * data = static_cast<const char *>(t->Data(0));
+				planes->insert(planes->end(), data, data + t->LinearSize(0));
+			}
+
+		return planes;
+	}
+
+	// compress the textures here on the worker thread, the writer only has to output them.
+	// Given the planes of the set before, they are XORed with them first, which zeroes unchanged blocks,
+	//  or are compressed with them as the dictionary.
+	void EncodeSet(const DeltaChain::Planes * previous) {
+
+		const void * tex[4] = {
+			compressedY->Data(0), compressedCb->Data(0), compressedCr->Data(0),
+			compressedA ? compressedA->Data(0) : NULL };
+		const int size[4] = {
+			compressedY->LinearSize(0), compressedCb->LinearSize(0), compressedCr->LinearSize(0),
+			compressedA ? compressedA->LinearSize(0) : 0 };
+
+		std::vector<char> xored;
+		const void * xored_tex[4] = { NULL, NULL, NULL, NULL };
+
+		if(previous && previous->size() != (size_t)(size[0] + size[1] + size[2] + size[3]))
+			throw std::runtime_error("delta: set size changed");
+
+		const void * dict[4] = { NULL, NULL, NULL, NULL };
+
+		if(previous && delta->Dictionary()) {
+
+			int offset = 0;
+			for(int i=0; i<4; i++) {
+				if(size[i])
+					dict[i] = &(*previous)[offset];
+				offset += size[i];
+			}
+		}
+		else if(previous) {
+
+			Trace::Span span("delta", "encode", set_index);
+
+			xored.resize( previous->size() );
+
+			int offset = 0;
+			for(int i=0; i<4; i++) {
+				const char * t = static_cast<const char *>(tex[i]);
+				for(int j=0; j<size[i]; j++)
+					xored[offset + j] = t[j] ^ (*previous)[offset + j];
+				if(size[i])
+					xored_tex[i] = &xored[offset];
+				offset += size[i];
+			}
+		}
+
+		const int flags = (delta && delta->IsKeySet(set_index)) ? KNIB_SET_KEY : 0;
+
+		{
+			Trace::Span span(codec.Name(), "encode", set_index);
+			if(dict[0])
+				encoded = std::unique_ptr<KnibSet>( new KnibSet(codec, tex, size, flags, dict) );
+			else
+				encoded = std::unique_ptr<KnibSet>( new KnibSet(codec, previous ? xored_tex : tex, size, flags) );
+		}
+	}
+
+	// the textures aren't needed once the set is encoded to size.
+	void Release() {
+
+		Y.reset();
+		Cb.reset();
+		Cr.reset();
+		A.reset();
+		compressedY.reset();
+		compressedCb.reset();
+		compressedCr.reset();
+		compressedA.reset();
+	}
+
 	static int CrCbAdjustResolution(int res,int channel) {
 
 	  switch(channel) {
@@ -136,12 +257,18 @@ class PlanarWorkSet {
 
 public:
 
-	PlanarWorkSet(std::vector<std::unique_ptr<Image> > &images, int w, int h, bool alpha, bool do_lz4, imgFormat textureFmt, copy_quality_t quality, int set_index)
+	PlanarWorkSet(std::vector<std::unique_ptr<Image> > &images, int w, int h, bool alpha, const Codec & codec, imgFormat textureFmt, copy_quality_t quality, int strip_threads, std::shared_ptr<RateControl> rate, int max_set_size, std::shared_ptr<DeltaChain> delta, int set_index)
 		:	w(w), h(h),
 		 	alpha(alpha),
-		 	do_lz4(do_lz4),
+		 	codec(codec),
 		 	textureFmt(textureFmt),
 			quality(quality),
+			strip_threads(strip_threads),
+			rate(rate),
+			luma_quality(quality),
+			chroma_quality(quality),
+			max_set_size(max_set_size),
+			delta(delta),
 		 	set_index(set_index)
 	{
 		if(images[0])
@@ -161,8 +288,29 @@ public:
 		return set_index;
 	}
 
+	// false if the set couldn't be encoded, or not within --max-set-size.
 	bool Work() {
 
+		bool ok;
+		try {
+			ok = Encode();
+		}
+		catch(const std::exception & e) {
+			printf("set %d: %s\n", set_index, e.what());
+			ok = false;
+		}
+
+		// the set after this one may be waiting for planes that will never come.
+		if(!ok && delta)
+			delta->Abort();
+
+		return ok;
+	}
+
+	bool Encode() {
+
+		Trace::Span span("encode set", "encode", set_index);
+
 		std::vector<std::unique_ptr<Image> > images;
 		images.push_back( std::move(work_input_img0) );
 		images.push_back( std::move(work_input_img1) );
@@ -196,7 +344,12 @@ public:
 
 			if(img) {
 
-				if(img->Width() != this->w || img->Height() != this->h) {
+				Trace::Span span("convert", "encode", set_index);
+
+				// 4:2:0 frames are never resized, main_planar only takes them at the texture size.
+				const bool yuv420 = img->Format() == IMG_FMT_YUV420P || img->Format() == IMG_FMT_YUVA420P;
+
+				if(!yuv420 && (img->Width() != this->w || img->Height() != this->h)) {
 
 					if(!resized)
 						resized = std::unique_ptr<Image>( new Image(this->w, this->h, IMG_FMT_RGBA32) );
@@ -220,20 +373,63 @@ public:
 				}
 			}
 		}
-		if(!DoTextureCompression())
+		const std::vector<RateControl::Level> ladder = RateControl::Ladder(quality);
+
+		int level = rate ? rate->CurrentLevel() : 0;
+
+		// The set after this one waits for our planes, so they're handed on as soon as they are final.
+		// Sets that may go down the quality ladder can't know that until they are encoded.
+		const bool publish_early = !max_set_size;
+		std::shared_ptr<const DeltaChain::Planes> planes;
+		std::shared_ptr<const DeltaChain::Planes> previous;
+
+		for(;;) {
+
+			luma_quality = ladder[level].luma;
+			chroma_quality = ladder[level].chroma;
+
+			if(!DoTextureCompression())
+				return false;
+
+			if(delta) {
+
+				planes = GatherPlanes();
+
+				if(publish_early)
+					delta->Publish(set_index, planes);
+
+				if(!previous && !delta->IsKeySet(set_index)) {
+					Trace::Span span("wait for previous set", "wait", set_index);
+					if(!(previous = delta->Previous(set_index)))
+						return false; // the set before failed.
+				}
+			}
+
+			EncodeSet(previous.get());
+
+			if(!max_set_size || encoded->Header().data_size <= max_set_size || (size_t)level+1 == ladder.size())
+				break;
+
+			++level;
+		}
+
+		if(delta && !publish_early)
+			delta->Publish(set_index, planes);
+
+		Release();
+
+		if(rate)
+			rate->Report(set_index, level, encoded->Header().data_size);
+
+		if(max_set_size && encoded->Header().data_size > max_set_size) {
+			printf("set %d is %d bytes at the lowest quality, over --max-set-size\n", set_index, encoded->Header().data_size);
 			return false;
+		}
 
 		return true;
 	}
 
-	void * YData()  const { return compressedY ->Data(0); }
-	void * CBData() const { return compressedCb->Data(0); }
-	void * CRData() const { return compressedCr->Data(0); }
-	void * AData()  const { return compressedA ? compressedA ->Data(0) : NULL; }
-
-	int    YSize()  const { return compressedY ->LinearSize(0); }
-	int    CBSize() const { return compressedCb->LinearSize(0); }
-	int    CRSize() const { return compressedCr->LinearSize(0); }
-	int    ASize()  const { return compressedA ? compressedA ->LinearSize(0) : 0; }
+	// hands the encoded set over to the writer, which keeps it until it's on disk.
+	std::unique_ptr<KnibSet> ReleaseEncodedSet() { return std::move(encoded); }
 };
 
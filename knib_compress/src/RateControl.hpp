@@ -0,0 +1,133 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <stdexcept>
+#include <libimgutil.h>
+
+// Picks the texture compression quality of each set to keep the output near a target bitrate.
+// Work sets ask for a level before they compress, and report the size they came out at.
+// The level steps down the ladder while the rolling average set size is over budget, and back
+//  up once it is comfortably under. Every choice can be logged for auditing.
+class RateControl {
+
+public:
+
+	struct Level {
+		copy_quality_t luma;	// Y ( and A )
+		copy_quality_t chroma;	// Cb and Cr
+	};
+
+private:
+
+	std::vector<Level> ladder;
+
+	const double set_budget;	// bytes per set.
+	const int window;
+
+	std::mutex mutex;
+	std::deque<int> sizes;
+	long long sum {0};
+	int level {0};
+
+	FILE * log {NULL};
+
+	static const char * QualityName(copy_quality_t q) {
+
+		switch(q) {
+		case COPY_QUALITY_LOWEST: return "LO";
+		case COPY_QUALITY_MEDIUM: return "MED";
+		default: return "HI";
+		}
+	}
+
+public:
+
+	// 'mbps' is the target in MB/s, 'fps' the playback frame rate and 'frames_per_set' 3 for planar.
+	// 'quality' is the best level, as given by --quality.
+	RateControl(double mbps, int fps, int frames_per_set, copy_quality_t quality, const char * log_fn = NULL, int window = 8)
+		:	ladder(Ladder(quality)),
+		 	set_budget(mbps * 1000000.0 * frames_per_set / fps),
+		 	window(window)
+	{
+		if(log_fn) {
+			if(!(log = fopen(log_fn, "w")))
+				throw std::runtime_error("can't open rate log!");
+			fprintf(log, "# set level luma chroma size average budget\n");
+		}
+	}
+
+	RateControl(const RateControl &) = delete;
+
+	~RateControl() {
+
+		if(log)
+			fclose(log);
+	}
+
+	// Best first, starting from 'quality'. The MED/LO level reduces chroma only.
+	// Every level is cheaper than the one before, none is better than 'quality' in luma or chroma.
+	static std::vector<Level> Ladder(copy_quality_t quality) {
+
+		const Level levels[] = {
+			{ quality, quality },
+			{ COPY_QUALITY_MEDIUM, COPY_QUALITY_MEDIUM },
+			{ COPY_QUALITY_MEDIUM, COPY_QUALITY_LOWEST },
+			{ COPY_QUALITY_LOWEST, COPY_QUALITY_LOWEST } };
+
+		std::vector<Level> ladder;
+
+		for(const Level & l : levels) {
+
+			if(l.luma > quality || l.chroma > quality)
+				continue;
+
+			if(!ladder.empty() && ladder.back().luma == l.luma && ladder.back().chroma == l.chroma)
+				continue;
+
+			ladder.push_back(l);
+		}
+
+		return ladder;
+	}
+
+	int Levels() const { return ladder.size(); }
+
+	const Level & GetLevel(int l) const { return ladder[l]; }
+
+	double SetBudget() const { return set_budget; }
+
+	// the level the next set should start at.
+	int CurrentLevel() {
+
+		std::unique_lock<std::mutex> lock( mutex );
+		return level;
+	}
+
+	// A set was encoded at 'l' and came out at 'size' bytes.
+	void Report(int set_index, int l, int size) {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		sizes.push_back(size);
+		sum += size;
+		if(sizes.size() > (size_t)window) {
+			sum -= sizes.front();
+			sizes.pop_front();
+		}
+
+		const double average = (double)sum / sizes.size();
+
+		if(average > set_budget && (size_t)level+1 < ladder.size())
+			++level;
+		else if(average < 0.85 * set_budget && level > 0)
+			--level;
+
+		if(log)
+			fprintf(log, "%d %d %s %s %d %.0f %.0f\n", set_index, l,
+				QualityName(ladder[l].luma), QualityName(ladder[l].chroma), size, average, set_budget);
+	}
+};
@@ -10,6 +10,7 @@
 #include <map>
 
 #include "KnibFile.hpp"
+#include "Trace.hpp"
 
 template<typename WorkSetType>
 class SetAssembler {
@@ -21,7 +22,10 @@ class SetAssembler {
 	std::mutex			  		mutex;
 	std::condition_variable 	writable;
 	std::condition_variable 	readable;
-	int							final_set_index{-1};
+	int							final_set_index{-1}; // -1 for no sets at all, once 'finished'.
+	bool						finished{false}; // 'FinalSetIndex' was called.
+	bool						aborted{false}; // see 'Abort'
+	bool						failed{false};  // a set failed to write.
 
 	std::shared_ptr<KnibFile> knibFile;
 
@@ -32,13 +36,9 @@ class SetAssembler {
 
 		printf("SetAssembler: Output %d\n", ws->GetSetIndex());
 
-		bool result = knibFile->OutputPlanar(
-			ws-> YData(), ws-> YSize(),
-			ws->CBData(), ws->CBSize(),
-			ws->CRData(), ws->CRSize(),
-			ws-> AData(), ws-> ASize());
+		Trace::Span span("write", "write", ws->GetSetIndex());
 
-		if(!result)
+		if(!knibFile->OutputSet(ws->ReleaseEncodedSet()))
 			throw std::runtime_error("output error!");
 	}
 
@@ -46,35 +46,35 @@ class SetAssembler {
 
 		printf("SetAssembler: Output %d\n", ws->GetSetIndex());
 
-		bool result = knibFile->OutputPacked(
-			ws->RGB0Data(), ws->RGB0Size(),
-			ws->RGB1Data(), ws->RGB1Size(),
-			ws->RGB2Data(), ws->RGB2Size(),
-			ws->A012Data(), ws->A012Size());
+		Trace::Span span("write", "write", ws->GetSetIndex());
 
-		if(!result)
-			throw std::runtime_error("output error!");
+		for(std::unique_ptr<KnibSet> & set : ws->ReleaseEncodedSets())
+			if(!knibFile->OutputSet(std::move(set)))
+				throw std::runtime_error("output error!");
 	}
 
 	bool NeedMoreSets() const {
 
-		return (final_set_index < 0) || (final_set_index >= next_set);
+		return !finished || (final_set_index >= next_set);
 	}
 
 	std::unique_ptr<WorkSetType> GetNextSet() {
 
+		Trace::Span span("wait for set", "wait", next_set);
+
 		std::unique_lock<std::mutex> lock( mutex );
 
 		typename Map::iterator itor = map.end();
 
-		while( NeedMoreSets() && (itor = map.find(next_set)) == map.end())
+		while( !aborted && NeedMoreSets() && (itor = map.find(next_set)) == map.end())
 			readable.wait( lock );
 
 		std::unique_ptr<WorkSetType> ws;
-		if( itor != map.end()) {
+		if( !aborted && itor != map.end()) {
 			next_set++;
 			ws = std::move(itor->second);
 			map.erase(itor);
+			Trace::Instance().Counter("assembled sets", map.size());
 		}
 		writable.notify_all();
 
@@ -83,14 +83,26 @@ class SetAssembler {
 
 	void WriteThread() {
 
+		Trace::Instance().ThreadName("writer");
+
 		for(;;) {
 
 			std::unique_ptr<WorkSetType> ws = GetNextSet();
 
-			if(ws)
+			if(!ws)
+				break;
+
+			try {
 				Output(std::move(ws));
-			else
+			}
+			catch(const std::exception & e) {
+				printf("ERROR: %s\n", e.what());
+				std::unique_lock<std::mutex> lock( mutex );
+				failed = true;
+				aborted = true;
+				writable.notify_all();
 				break;
+			}
 		}
 	}
 
@@ -106,7 +118,34 @@ public:
 
 	~SetAssembler() {
 
-		thread.join();
+		Finish();
+	}
+
+	// waits for the writer. Returns false if a set failed to write.
+	bool Finish() {
+
+		if(thread.joinable())
+			thread.join();
+
+		return !Failed();
+	}
+
+	bool Failed() {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		return failed;
+	}
+
+	// a set will never arrive, stop writing and stop holding workers back.
+	void Abort() {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		aborted = true;
+
+		readable.notify_all();
+		writable.notify_all();
 	}
 
 	void Assemble( std::unique_ptr<WorkSetType> set ) {
@@ -119,11 +158,15 @@ public:
 
 		map[ setIndex ] = std::move(set);
 
+		Trace::Instance().Counter("assembled sets", map.size());
+
 		readable.notify_one();
 
+		Trace::Span span("wait for writer", "wait", setIndex);
+
 		// worker threads are delivering sets faster than we can output them to disk.
 		// here we stall to prevent too much memory being consumed.
-		while( map.size() > max_sets )
+		while( !aborted && map.size() > (size_t)max_sets )
 			writable.wait( lock );
 	}
 
@@ -132,6 +175,7 @@ public:
 		std::unique_lock<std::mutex> lock( mutex );
 
 		this->final_set_index = final_set_index;
+		finished = true;
 
 		readable.notify_one();
 	}
@@ -10,6 +10,7 @@
 
 #include "PlanarWorkSet.hpp"
 #include "PackedWorkSet.hpp"
+#include "Trace.hpp"
 
 template<typename WorkType>
 class ThreadPool
@@ -21,7 +22,8 @@ class ThreadPool
 	WorkDeque 		workDeque;
 	const int		max_queue;
 	bool			noMoreWork{false};
-	int				final_set_index{0};
+	bool			failed{false}; // a set failed to encode, the rest are dropped.
+	int				final_set_index{-1}; // -1 until work is added.
 
 	std::mutex mutex;
 	std::condition_variable readable;
@@ -31,19 +33,23 @@ class ThreadPool
 
 	std::unique_ptr<WorkType> GetWork() {
 
+		Trace::Span span("wait for work", "wait");
+
 		std::unique_lock<std::mutex> lock( mutex );
 
-		while( !noMoreWork && ( workDeque.size() == 0) )
+		while( !noMoreWork && !failed && ( workDeque.size() == 0) )
 			readable.wait( lock );
 
 		std::unique_ptr<WorkType> work;
 
-		if(workDeque.size()) {
+		if(!failed && workDeque.size()) {
 
 			work = std::move(workDeque.front());
 
 			workDeque.pop_front();
 
+			Trace::Instance().Counter("work queue", workDeque.size());
+
 			writable.notify_all();
 		}
 
@@ -52,6 +58,8 @@ class ThreadPool
 
 	void Main() {
 
+		Trace::Instance().ThreadName("worker");
+
 		std::unique_ptr<WorkType> work;
 
 		while( ( work = std::move(GetWork()) ) ) {
@@ -62,11 +70,27 @@ class ThreadPool
 				setAssembler.Assemble( std::move(work) );
 			else {
 				printf("ThreadPool: WORK ERROR!\n");
-				throw std::runtime_error("WorkType error.");
+				Fail();
 			}
 		}
 	}
 
+	// drops the queued work, and stops the writer waiting for the set that failed.
+	void Fail() {
+
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+
+			failed = true;
+			workDeque.clear();
+
+			readable.notify_all();
+			writable.notify_all();
+		}
+
+		setAssembler.Abort();
+	}
+
 public:
 
 	ThreadPool(std::shared_ptr<KnibFile> knibFile, int threads)
@@ -80,20 +104,34 @@ public:
 
 	~ThreadPool() {
 
-		for(int i=0;i<threadVector.size(); i++)
-			threadVector[i].join();
+		Finish();
+	}
+
+	// true once a set has failed to encode or write, later work is dropped.
+	bool Failed() {
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		return failed || setAssembler.Failed();
 	}
 
 	void AddWork( std::unique_ptr<WorkType> work ) {
 
 		std::unique_lock<std::mutex> lock( mutex );
 
+		if(failed)
+			return;
+
 		final_set_index = work->GetSetIndex();
 
 		workDeque.push_back( std::move(work) );
 		readable.notify_all();
 
-		while(workDeque.size() >= max_queue)
+		Trace::Instance().Counter("work queue", workDeque.size());
+
+		Trace::Span span("wait for worker", "wait");
+
+		while(!failed && workDeque.size() >= (size_t)max_queue)
 			writable.wait(lock);
 	}
 
@@ -107,5 +145,16 @@ public:
 
 		readable.notify_all();
 	}
+
+	// waits for the workers and the writer, call after 'NoMoreWork'.
+	// Returns false if any set failed, the output is then incomplete.
+	bool Finish() {
+
+		for(std::thread & thread : threadVector)
+			if(thread.joinable())
+				thread.join();
+
+		return setAssembler.Finish() && !Failed();
+	}
 };
 
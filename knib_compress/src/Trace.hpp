@@ -0,0 +1,167 @@
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// Opt-in pipeline tracing ( --trace FILE ).
+// Records timed spans and counters from every pipeline thread, and writes them out as Chrome
+//  trace event JSON, which chrome://tracing and https://ui.perfetto.dev can load.
+// When tracing is off a span costs one branch.
+class Trace {
+
+	struct Event {
+		char phase;			// 'X' span, 'C' counter, 'M' thread name.
+		const char * name;	// string literals only.
+		const char * cat;
+		int tid;
+		int64_t ts;			// microseconds since Open().
+		int64_t dur;
+		int value;			// set index for spans, -1 for none. value for counters.
+	};
+
+	FILE * file {NULL};
+	bool enabled {false};
+	std::chrono::steady_clock::time_point start;
+
+	std::mutex mutex;
+	std::vector<Event> events;
+	std::atomic<int> next_tid {1};
+
+	Trace() {}
+
+	int Tid() {
+
+		static thread_local int tid = 0;
+		if(!tid)
+			tid = next_tid++;
+		return tid;
+	}
+
+	void Add(const Event & e) {
+
+		std::unique_lock<std::mutex> lock( mutex );
+		events.push_back(e);
+	}
+
+public:
+
+	static Trace & Instance() {
+
+		static Trace trace;
+		return trace;
+	}
+
+	// Start recording, the trace is written to 'fn' by Close().
+	bool Open(const char * fn) {
+
+		if(!(file = fopen(fn, "w"))) {
+			printf("ERROR: can't open trace file %s\n", fn);
+			return false;
+		}
+
+		start = std::chrono::steady_clock::now();
+		events.reserve(1 << 16);
+		enabled = true;
+		return true;
+	}
+
+	bool Enabled() const { return enabled; }
+
+	int64_t Now() const {
+
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+
+	// a span that started at 'ts' and finishes now.
+	void Complete(const char * name, const char * cat, int64_t ts, int set = -1) {
+
+		if(enabled)
+			Add( Event { 'X', name, cat, Tid(), ts, Now() - ts, set } );
+	}
+
+	// a queue depth or similar.
+	void Counter(const char * name, int value) {
+
+		if(enabled)
+			Add( Event { 'C', name, "queue", Tid(), Now(), 0, value } );
+	}
+
+	// name the calling thread in the trace viewer.
+	void ThreadName(const char * name) {
+
+		if(enabled)
+			Add( Event { 'M', name, "", Tid(), 0, 0, 0 } );
+	}
+
+	// Times its own scope.
+	class Span {
+
+		const char * name;
+		const char * cat;
+		int set;
+		int64_t ts;
+
+	public:
+
+		Span(const char * name, const char * cat, int set = -1)
+			:	name(name), cat(cat), set(set),
+			 	ts(Trace::Instance().Enabled() ? Trace::Instance().Now() : 0)
+		{}
+
+		~Span() {
+
+			Trace::Instance().Complete(name, cat, ts, set);
+		}
+	};
+
+	// Stop recording and write the JSON file.
+	void Close() {
+
+		if(!enabled)
+			return;
+
+		enabled = false;
+
+		std::unique_lock<std::mutex> lock( mutex );
+
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+		for(size_t i=0;i<events.size();i++) {
+
+			const Event & e = events[i];
+			const char * sep = (i+1 < events.size()) ? "," : "";
+
+			switch(e.phase) {
+			case 'X':
+				fprintf(file, "{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+					e.name, e.cat, e.tid, (long long)e.ts, (long long)e.dur);
+				if(e.value >= 0)
+					fprintf(file, ",\"args\":{\"set\":%d}", e.value);
+				fprintf(file, "}%s\n", sep);
+				break;
+			case 'C':
+				fprintf(file, "{\"ph\":\"C\",\"name\":\"%s\",\"cat\":\"%s\",\"pid\":1,\"ts\":%lld,\"args\":{\"depth\":%d}}%s\n",
+					e.name, e.cat, (long long)e.ts, e.value, sep);
+				break;
+			case 'M':
+				fprintf(file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}%s\n",
+					e.tid, e.name, sep);
+				break;
+			}
+		}
+
+		fprintf(file, "]}\n");
+
+		if(fclose(file) != 0)
+			printf("ERROR: failed to write trace file.\n");
+
+		file = NULL;
+		events.clear();
+	}
+};
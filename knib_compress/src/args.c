@@ -17,15 +17,34 @@ static struct argp_option options[] = {
   {"DXT1",     'D', 0,              OPTION_ARG_OPTIONAL,  "Use DXT1 texture compression" },
   {"ETC1",     'E', 0,              OPTION_ARG_OPTIONAL,  "Use ETC1 texture compression" },
   {"LZ4",      'L', 0,              OPTION_ARG_OPTIONAL,  "Use LZ4 file compression" },
+  {"zstd",     'Z', 0,              OPTION_ARG_OPTIONAL,  "Use zstd file compression" },
+  {"shuffle",  'S', 0,              OPTION_ARG_OPTIONAL,  "Split texture blocks into colour and index streams before file compression." },
 
   {"packed",   'k', 0,              OPTION_ARG_OPTIONAL,  "Use a packed pixel format." },
   {"planar",   'n', 0,              OPTION_ARG_OPTIONAL,  "Use a planar pixel format." },
 
   {"quality",         'q', "HI|MED|LO", 0, "Texture compression Quality." },
+  {"level",           'c', "LEVEL",     0, "File compression level. LZ4: 0 fast, 1 HC.(1) zstd: 1 to 22.(9)" },
+  {"min-ratio",       'M', "RATIO",     0, "Store sets that zstd or LZ4 don't shrink by this ratio the cheaper to decode way. (off)" },
   {"from-frame",      'f', "FRAME#",    0, "First Frame Number"   },
   {"to-frame",        't', "FRAME#",    0, "Last Frame Number"    },
   {"increment-frame", 'i', "COUNT" ,    0, "Increment Number.(1)" },
 
+  {"reader-threads",  'r', "COUNT" ,    0, "Input decoding threads.(4)" },
+  {"lookahead",       'l', "FRAMES",    0, "Frames to read ahead of the encoder.(12)" },
+  {"strip-threads",   's', "COUNT" ,    0, "Threads compressing each set.(cores / 8)" },
+  {"imgutil",         'u', 0,              OPTION_ARG_OPTIONAL,  "Use libimgutil's texture compressors and colour conversion." },
+  {"y4m",             'y', 0,              OPTION_ARG_OPTIONAL,  "Input is a YUV4MPEG2 4:2:0 stream ( - for stdin )." },
+  {"rgba",            'R', "WxH",       0, "Input is a stream of raw WxH RGBA frames ( - for stdin )." },
+  {"target-bitrate",  'b', "MB/s",      0, "Lower the quality of sets as needed to average this bitrate. (planar only)" },
+  {"fps",             'p', "FPS",       0, "Playback frame rate, for --target-bitrate.(30)" },
+  {"rate-log",        'g', "FILE",      0, "Log the quality chosen for each set by --target-bitrate." },
+  {"max-set-size",    'm', "BYTES",     0, "Encode sets at lower quality until none is bigger than this." },
+  {"delta",           'd', 0,              OPTION_ARG_OPTIONAL,  "Store sets as a delta from the set before. (planar only)" },
+  {"dict",            'x', 0,              OPTION_ARG_OPTIONAL,  "LZ4 compress sets with the set before as a dictionary. (planar only)" },
+  {"key-interval",    'K', "SETS",      0, "Sets from one --delta or --dict key set to the next.(10)" },
+  {"trace",           'T', "FILE",      0, "Write a Chrome trace (chrome://tracing) of the encoder pipeline." },
+
   { 0 }
 };
 
@@ -42,7 +61,24 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
     	arguments->flags |= KNIB_TEX_ETC1;
     	break;
     case 'L':
-    	arguments->flags |= KNIB_DATA_LZ4;
+    case 'Z':
+    	// only one file compression.
+    	if(arguments->flags & KNIB_DATA_MASK)
+    		argp_usage (state);
+    	arguments->flags |= (key == 'L') ? KNIB_DATA_LZ4 : KNIB_DATA_ZSTD;
+    	break;
+    case 'M':
+    	arguments->min_ratio = atof(arg);
+    	if(arguments->min_ratio < 1.0)
+    		argp_usage (state);
+    	break;
+    case 'S':
+    	arguments->flags |= KNIB_DATA_SHUFFLE;
+    	break;
+    case 'c':
+    	arguments->level = atoi(arg);
+    	if(arguments->level < 0)
+    		argp_usage (state);
     	break;
     case 'k':
     	arguments->flags |= KNIB_CHANNELS_PACKED;
@@ -71,6 +107,64 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
     case 'i':
     	arguments->ff_inc = atoi(arg);
     	break;
+    case 'r':
+    	arguments->reader_threads = atoi(arg);
+    	if(arguments->reader_threads < 1)
+    		argp_usage (state);
+    	break;
+    case 'l':
+    	arguments->lookahead = atoi(arg);
+    	if(arguments->lookahead < 1)
+    		argp_usage (state);
+    	break;
+    case 'u':
+    	arguments->imgutil = 1;
+    	break;
+    case 's':
+    	arguments->strip_threads = atoi(arg);
+    	if(arguments->strip_threads < 1)
+    		argp_usage (state);
+    	break;
+    case 'y':
+    	arguments->y4m = 1;
+    	break;
+    case 'R':
+    	if(sscanf(arg, "%dx%d", &arguments->rgba_width, &arguments->rgba_height) != 2 ||
+    	   arguments->rgba_width < 1 || arguments->rgba_height < 1)
+    		argp_usage (state);
+    	break;
+    case 'b':
+    	arguments->target_bitrate = atof(arg);
+    	if(arguments->target_bitrate <= 0)
+    		argp_usage (state);
+    	break;
+    case 'p':
+    	arguments->fps = atoi(arg);
+    	if(arguments->fps < 1)
+    		argp_usage (state);
+    	break;
+    case 'g':
+    	arguments->rate_log = arg;
+    	break;
+    case 'm':
+    	arguments->max_set_size = atoi(arg);
+    	if(arguments->max_set_size < 1)
+    		argp_usage (state);
+    	break;
+    case 'T':
+    	arguments->trace_fn = arg;
+    	break;
+    case 'd':
+    	arguments->flags |= KNIB_DATA_DELTA;
+    	break;
+    case 'x':
+    	arguments->flags |= KNIB_DATA_DICT;
+    	break;
+    case 'K':
+    	arguments->key_interval = atoi(arg);
+    	if(arguments->key_interval < 1)
+    		argp_usage (state);
+    	break;
 
     case ARGP_KEY_ARG:
     	{
@@ -105,6 +199,14 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
     	if(!arguments->flags)
     		err=5;
 
+    	if(arguments->y4m && arguments->rgba_width)
+    		err=6;
+
+    	// dictionaries are an LZ4 feature, and XORed or shuffled planes can't share one.
+    	if((arguments->flags & KNIB_DATA_DICT) &&
+    	   ((arguments->flags & (KNIB_DATA_DELTA | KNIB_DATA_SHUFFLE)) || (arguments->flags & KNIB_DATA_MASK) != KNIB_DATA_LZ4))
+    		err=7;
+
     	if(err)
     		argp_usage (state);
 
@@ -129,6 +231,11 @@ struct arguments read_args(int argc, char ** argv ) {
   // defaults
   args.ff_inc = 1;
   args.quality = COPY_QUALITY_HIGHEST;
+  args.reader_threads = 4;
+  args.lookahead = 12;
+  args.fps = 30;
+  args.key_interval = 10;
+  args.level = -1;
 
   argp_parse (&argp, argc, argv, 0, 0, &args);
 
@@ -23,6 +23,43 @@ struct arguments {
 
 	// Texture compression quality.
 	copy_quality_t quality;
+
+	// Input decoding threads, and how many frames they may read ahead.
+	int reader_threads;
+	int lookahead;
+
+	// Threads used to texture compress a single set, 0 for one per core.
+	int strip_threads;
+
+	// Texture compress and colour convert with libimgutil even where there is an in-tree version.
+	int imgutil;
+
+	// Read a YUV4MPEG2 stream, or raw RGBA frames of rgba_width x rgba_height, from the
+	//  input ( "-" for stdin ) rather than a sequence of image files.
+	int y4m;
+	int rgba_width;
+	int rgba_height;
+
+	// Planar only: choose the quality of each set to average target_bitrate MB/s at fps frames
+	//  per second ( 0 for a fixed --quality ), logging each choice to rate_log if not NULL.
+	double target_bitrate;
+	int fps;
+	char * rate_log;
+
+	// Largest compressed set to allow, 0 for no limit.
+	int max_set_size;
+
+	// Planar only: with KNIB_DATA_DELTA or KNIB_DATA_DICT in flags, every key_interval'th set is a key set.
+	int key_interval;
+
+	// File compression level, -1 for the codecs default. ( see 'Codec' )
+	int level;
+
+	// Sets must compress by this ratio, or are stored the cheaper to decode way. 0 for off. ( see 'Codec' )
+	double min_ratio;
+
+	// Chrome trace JSON output, or NULL.
+	char * trace_fn;
 };
 
 struct arguments read_args(int argc, char ** argv );
@@ -0,0 +1,429 @@
+/*
+ knib_bench - times the texture encoders on a synthetic Knib plane, and measures their PSNR.
+
+ knib_bench [WIDTH HEIGHT [ITERATIONS]]
+ knib_bench --codecs FILE.kib [ITERATIONS]
+
+ The plane looks like a knib_compress 'Y' texture, each texel holds the same sample
+ from 3 consecutive frames of a slowly moving scene.
+
+ With --codecs, the texture planes of a real Knib file are compressed again by each codec,
+ and the compression ratio and decode speed reported.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <libimg.h>
+#include <libimgutil.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "Image.hpp"
+#include "Dxt1Encoder.hpp"
+#include "Etc1Encoder.hpp"
+#include "Codec.hpp"
+#include "KnibInput.hpp"
+
+static void MakePlane(Image & plane) {
+
+	unsigned char * d = static_cast<unsigned char *>(plane.Data(0));
+
+	unsigned int rnd = 12345;
+
+	for(int y=0;y<plane.Height();y++) {
+		for(int x=0;x<plane.Width();x++) {
+			for(int f=0;f<3;f++) {
+				const float fx = (x + 2*f) * 0.02f;
+				const float fy = y * 0.03f;
+				int v = (int)(128 + 60*sinf(fx) + 40*cosf(fy + fx*0.5f));
+				rnd = rnd * 1103515245u + 12345u;
+				v += (int)((rnd >> 16) & 7) - 3;
+				d[f] = v < 0 ? 0 : v > 255 ? 255 : v;
+			}
+			d[3] = 0xff;
+			d += 4;
+		}
+	}
+}
+
+static void Decode565(unsigned short c, int rgb[3]) {
+
+	const int r = (c >> 11) & 31;
+	const int g = (c >>  5) & 63;
+	const int b = (c      ) & 31;
+
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// decode one DXT1 block to 16 raster order RGB pixels.
+static void DecodeDxt1(const unsigned char * b, int px[16][3]) {
+
+	const unsigned short c0 = b[0] | (b[1] << 8);
+	const unsigned short c1 = b[2] | (b[3] << 8);
+	const unsigned int idx = b[4] | (b[5] << 8) | (b[6] << 16) | ((unsigned)b[7] << 24);
+
+	int pal[4][3];
+	Decode565(c0, pal[0]);
+	Decode565(c1, pal[1]);
+	for(int j=0;j<3;j++) {
+		if(c0 > c1) {
+			pal[2][j] = (2*pal[0][j] + pal[1][j]) / 3;
+			pal[3][j] = (pal[0][j] + 2*pal[1][j]) / 3;
+		}
+		else {
+			pal[2][j] = (pal[0][j] + pal[1][j]) / 2;
+			pal[3][j] = 0;
+		}
+	}
+
+	for(int i=0;i<16;i++)
+		memcpy(px[i], pal[ (idx >> (2*i)) & 3 ], sizeof px[i]);
+}
+
+// decode one ETC1 block to 16 raster order RGB pixels.
+static void DecodeEtc1(const unsigned char * b, int px[16][3]) {
+
+	static const int modifiers[8][4] = {
+		{ 2, 8, -2, -8 }, { 5, 17, -5, -17 }, { 9, 29, -9, -29 }, { 13, 42, -13, -42 },
+		{ 18, 60, -18, -60 }, { 24, 80, -24, -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 },
+	};
+
+	const bool diff = b[3] & 2;
+	const bool flip = b[3] & 1;
+	const int table[2] = { b[3] >> 5, (b[3] >> 2) & 7 };
+
+	int base[2][3];
+	for(int j=0;j<3;j++) {
+		if(diff) {
+			const int c0 = b[j] >> 3;
+			const int d = (b[j] & 4) ? (b[j] & 7) - 8 : (b[j] & 7);
+			const int c1 = c0 + d;
+			base[0][j] = (c0 << 3) | (c0 >> 2);
+			base[1][j] = (c1 << 3) | ((c1 >> 2) & 7);
+		}
+		else {
+			base[0][j] = (b[j] >> 4) * 17;
+			base[1][j] = (b[j] & 15) * 17;
+		}
+	}
+
+	const unsigned int bits = ((unsigned)b[4] << 24) | (b[5] << 16) | (b[6] << 8) | b[7];
+
+	for(int y=0;y<4;y++) {
+		for(int x=0;x<4;x++) {
+			const int k = x * 4 + y;
+			const int idx = (((bits >> (16 + k)) & 1) << 1) | ((bits >> k) & 1);
+			const int sub = flip ? (y >= 2) : (x >= 2);
+			for(int j=0;j<3;j++) {
+				const int v = base[sub][j] + modifiers[ table[sub] ][idx];
+				px[4*y+x][j] = v < 0 ? 0 : v > 255 ? 255 : v;
+			}
+		}
+	}
+}
+
+// PSNR of a compressed texture against its RGBA32 source.
+static double Psnr(const Image & tex, const Image & src) {
+
+	const unsigned char * b = static_cast<const unsigned char *>(tex.Data(0));
+	const unsigned char * s = static_cast<const unsigned char *>(src.Data(0));
+
+	double sum = 0;
+	long n = 0;
+
+	for(int by=0;by<src.Height();by+=4) {
+		for(int bx=0;bx<src.Width();bx+=4) {
+
+			int px[16][3];
+
+			if(tex.Format() == IMG_FMT_DXT1)
+				DecodeDxt1(b, px);
+			else
+				DecodeEtc1(b, px);
+
+			for(int y=0;y<4 && by+y<src.Height();y++) {
+				for(int x=0;x<4 && bx+x<src.Width();x++) {
+					const unsigned char * p = s + src.LineSize(0) * (by+y) + 4 * (bx+x);
+					for(int j=0;j<3;j++)
+						sum += (p[j]-px[4*y+x][j]) * (p[j]-px[4*y+x][j]);
+					n += 3;
+				}
+			}
+			b += 8;
+		}
+	}
+
+	if(sum == 0)
+		return 99.0;
+
+	return 10.0 * log10( 255.0 * 255.0 * n / sum );
+}
+
+static const char * QualityName(copy_quality_t q) {
+
+	switch(q) {
+	case COPY_QUALITY_LOWEST: return "LO";
+	case COPY_QUALITY_MEDIUM: return "MED";
+	default: return "HI";
+	}
+}
+
+template<typename F>
+static double Time(int iterations, F f) {
+
+	f(); // warm up.
+
+	auto start = std::chrono::steady_clock::now();
+	for(int i=0;i<iterations;i++)
+		f();
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+struct Encoder {
+	const char * name;
+	int isa;	// -1 for libimgutil
+};
+
+template<typename E>
+static void Bench(const char * name, imgFormat fmt, const Image & plane, int iterations,
+	const std::vector<Encoder> & encoders, E encode)
+{
+	const double mpix = plane.Width() * plane.Height() / 1e6;
+
+	printf("%s %dx%d\n", name, plane.Width(), plane.Height());
+	printf("  %-4s %-10s %10s %10s %8s\n", "Q", "encoder", "ms/plane", "Mpix/s", "PSNR");
+
+	const copy_quality_t qualities[] = { COPY_QUALITY_LOWEST, COPY_QUALITY_MEDIUM, COPY_QUALITY_HIGHEST };
+
+	for(copy_quality_t q : qualities) {
+
+		Image tex(plane.Width(), plane.Height(), fmt);
+		Image ref(plane.Width(), plane.Height(), fmt);
+
+		encode(ref, q, 0);
+
+		for(const Encoder & e : encoders) {
+
+			double ms;
+
+			if(e.isa < 0) {
+				Image::BuiltinEncoders() = false;
+				ms = Time(iterations, [&]() {
+					if(!tex.CopyFrom(plane, ERR_DIFFUSE_KERNEL_DEFAULT, q))
+						throw std::runtime_error("libimgutil encode failed");
+				});
+				Image::BuiltinEncoders() = true;
+			}
+			else {
+				ms = Time(iterations, [&]() {
+					encode(tex, q, e.isa);
+				});
+			}
+
+			printf("  %-4s %-10s %10.2f %10.1f %8.2f", QualityName(q), e.name, ms, mpix * 1000.0 / ms, Psnr(tex, plane));
+
+			// the SIMD encoders must match the scalar one exactly.
+			if(e.isa > 0 && memcmp(tex.Data(0), ref.Data(0), ref.LinearSize(0)))
+				printf("  MISMATCH");
+
+			printf("\n");
+		}
+	}
+}
+
+static void BenchDxt1(const Image & plane, int iterations) {
+
+	std::vector<Encoder> encoders = {
+		{ "libimgutil", -1 },
+		{ "scalar", Dxt1Encoder::SCALAR },
+#if defined(__SSE2__)
+		{ "sse2", Dxt1Encoder::SSE2 },
+#endif
+#if defined(__AVX2__)
+		{ "avx2", Dxt1Encoder::AVX2 },
+#endif
+	};
+
+	Bench("DXT1", IMG_FMT_DXT1, plane, iterations, encoders, [&](Image & tex, copy_quality_t q, int isa) {
+		Dxt1Encoder::Encode(tex.Data(0), plane.Data(0), plane.Width(), plane.Height(),
+			plane.LineSize(0), q, (Dxt1Encoder::Isa)isa);
+	});
+}
+
+static void BenchEtc1(const Image & plane, int iterations) {
+
+	std::vector<Encoder> encoders = {
+		{ "libimgutil", -1 },
+		{ "scalar", Etc1Encoder::SCALAR },
+#if defined(__SSE2__)
+		{ "sse2", Etc1Encoder::SSE2 },
+#endif
+	};
+
+	Bench("ETC1", IMG_FMT_ETC1, plane, iterations, encoders, [&](Image & tex, copy_quality_t q, int isa) {
+		Etc1Encoder::Encode(tex.Data(0), plane.Data(0), plane.Width(), plane.Height(),
+			plane.LineSize(0), q, (Etc1Encoder::Isa)isa);
+	});
+}
+
+typedef std::vector<std::vector<char> > Planes;
+
+// every plane of every set in 'fn', as they were before file compression.
+static Planes LoadPlanes(const char * fn) {
+
+	KnibInput input(fn);
+
+	if(input.Header().flags & KNIB_DATA_DICT)
+		throw std::runtime_error("--dict sets can't be decompressed on their own!");
+
+	Planes planes;
+	std::shared_ptr<KnibSet> set;
+
+	while( (set = input.NextSet()) ) {
+
+		const knib_set_header & h = set->Header();
+		const Codec codec = Codec::OfSet(input.Header().flags, h.flags);
+
+		const int offset[4] = {
+			h.y_data_compressed_offset, h.cb_data_compressed_offset,
+			h.cr_data_compressed_offset, h.a_data_compressed_offset };
+		const int compressed_size[4] = {
+			h.y_data_compressed_size, h.cb_data_compressed_size,
+			h.cr_data_compressed_size, h.a_data_compressed_size };
+		const int size[4] = {
+			h.y_data_buffer_size, h.cb_data_buffer_size,
+			h.cr_data_buffer_size, h.a_data_buffer_size };
+
+		for(int i=0;i<4;i++) {
+
+			if(!size[i])
+				continue;
+
+			planes.push_back( std::vector<char>(size[i]) );
+
+			if(offset[i] < 0 || compressed_size[i] < 0 || offset[i] + compressed_size[i] > h.data_size ||
+				!codec.Decompress(static_cast<const char *>(set->Data()) + offset[i], compressed_size[i], &planes.back()[0], size[i]))
+				throw std::runtime_error("bad set data!");
+		}
+	}
+
+	return planes;
+}
+
+static void BenchCodecs(const Planes & planes, int iterations) {
+
+	struct { int data; int level; } configs[] = {
+		{ KNIB_DATA_LZ4, 0 },
+		{ KNIB_DATA_LZ4, 1 },
+#ifdef HAVE_ZSTD_H
+		{ KNIB_DATA_ZSTD, 1 },
+		{ KNIB_DATA_ZSTD, 3 },
+		{ KNIB_DATA_ZSTD, 9 },
+		{ KNIB_DATA_ZSTD, 19 },
+#endif
+	};
+
+	// each with and without the block shuffle.
+	std::vector<Codec> codecs;
+	for(const auto & c : configs) {
+		codecs.push_back( Codec(c.data, c.level) );
+		codecs.push_back( Codec(c.data | KNIB_DATA_SHUFFLE, c.level) );
+	}
+
+	long long raw = 0;
+	for(const std::vector<char> & plane : planes)
+		raw += plane.size();
+
+	printf("%d planes, %lld bytes\n", (int)planes.size(), raw);
+	printf("  %-6s %5s %8s %12s %8s %12s %12s\n", "codec", "level", "shuffle", "bytes", "ratio", "enc MB/s", "dec MB/s");
+
+	for(const Codec & codec : codecs) {
+
+		Planes compressed(planes.size());
+		long long bytes = 0;
+
+		const double enc_ms = Time(1, [&]() {
+			for(size_t i=0;i<planes.size();i++) {
+				compressed[i].resize( codec.Bound(planes[i].size()) );
+				compressed[i].resize( codec.Compress(&planes[i][0], planes[i].size(), &compressed[i][0]) );
+			}
+		});
+
+		for(const std::vector<char> & c : compressed)
+			bytes += c.size();
+
+		std::vector<char> out;
+		bool ok = true;
+
+		const double dec_ms = Time(iterations, [&]() {
+			for(size_t i=0;i<planes.size();i++) {
+				out.resize(planes[i].size());
+				ok = codec.Decompress(&compressed[i][0], compressed[i].size(), &out[0], out.size()) && ok;
+			}
+		});
+
+		printf("  %-6s %5d %8s %12lld %8.2f %12.1f %12.1f%s\n", codec.Name(), codec.Level(), codec.Shuffled() ? "yes" : "no", bytes, (double)raw / bytes,
+			raw / 1000.0 / enc_ms, raw / 1000.0 / dec_ms, ok ? "" : "  MISMATCH");
+	}
+}
+
+int main(int argc, char * argv[]) {
+
+	if(argc >= 3 && strcmp(argv[1], "--codecs") == 0) {
+
+		const int iterations = (argc >= 4) ? atoi(argv[3]) : 5;
+
+		try {
+			BenchCodecs(LoadPlanes(argv[2]), std::max(iterations, 1));
+		}
+		catch(const std::exception & e) {
+			printf("ERROR: %s\n", e.what());
+			return -1;
+		}
+		return 0;
+	}
+
+	int w = 1920;
+	int h = 1080;
+	int iterations = 5;
+
+	if(argc >= 3) {
+		w = atoi(argv[1]);
+		h = atoi(argv[2]);
+	}
+	if(argc >= 4)
+		iterations = atoi(argv[3]);
+
+	if(w < 4 || h < 4 || iterations < 1) {
+		printf("usage: knib_bench [WIDTH HEIGHT [ITERATIONS]]\n");
+		printf("       knib_bench --codecs FILE.kib [ITERATIONS]\n");
+		return -1;
+	}
+
+	try {
+		Image plane(w, h, IMG_FMT_RGBA32);
+
+		MakePlane(plane);
+
+		BenchDxt1(plane, iterations);
+		BenchEtc1(plane, iterations);
+	}
+	catch(const std::exception & e) {
+		printf("ERROR: %s\n", e.what());
+		return -1;
+	}
+
+	return 0;
+}
@@ -872,3 +872,73 @@ _output_error:
     return (int) (-(((char*)ip)-source));
 }
 
+
+int LZ4_decompress_fast_usingDict(const char* source,
+                 char* dest,
+                 int originalSize,
+                 const char* dictStart,
+                 int dictSize)
+{
+    // Local Variables
+    const BYTE* restrict ip = (const BYTE*) source;
+    const BYTE* ref;
+
+    BYTE* op = (BYTE*) dest;
+    BYTE* const oend = op + originalSize;
+    BYTE* cpy;
+    const BYTE* const dictEnd = (const BYTE*) dictStart + dictSize;
+
+    unsigned token;
+
+    size_t length;
+
+
+    // Main Loop
+    while (1)
+    {
+        // get runlength
+        token = *ip++;
+        if ((length=(token>>ML_BITS)) == RUN_MASK)  { size_t len; for (;(len=*ip++)==255;length+=255){} length += len; }
+
+        // copy literals
+        cpy = op+length;
+        if (cpy > oend) goto _output_error;              // Error : request to write beyond destination buffer
+        memcpy(op, ip, length);
+        ip += length;
+        op = cpy;
+        if (op == oend) break;                           // EOF
+
+        // get offset
+        LZ4_READ_LITTLEENDIAN_16(ref,cpy,ip); ip+=2;
+
+        // get matchlength
+        if ((length=(token&ML_MASK)) == ML_MASK) { for (;*ip==255;length+=255) {ip++;} length += *ip++; }
+        length += MINMATCH;
+        if (op + length > oend) goto _output_error;      // Error : request to write beyond destination buffer
+
+        // the match starts in the dictionary, and may run on into the destination buffer
+        if (ref < (BYTE* const)dest)
+        {
+            const size_t back = (BYTE* const)dest - ref;
+            size_t copy;
+            if (back > (size_t)dictSize) goto _output_error;   // Error : offset create reference outside dictionary
+            copy = (length < back) ? length : back;
+            memcpy(op, dictEnd - back, copy);
+            op += copy;
+            length -= copy;
+            ref = (BYTE* const)dest;
+        }
+
+        // copy repeated sequence, byte by byte if it overlaps itself
+        if ((size_t)(op - ref) >= length) { memcpy(op, ref, length); op += length; }
+        else { cpy = op + length; while (op < cpy) *op++ = *ref++; }
+    }
+
+    // end of decoding
+    return (int) (((char*)ip)-source);
+
+    // write overflow error detected
+_output_error:
+    return (int) (-(((char*)ip)-source));
+}
+
@@ -10,9 +10,13 @@
  Frames are grouped in sets of 3, and converted to YUV420P or YUVA420P ( YCbCr<A> ) colour space.
  The 'Y' channels from the 3 frames are pakced (Y0,Y1,Y2,Y0,Y1,Y2...) and further compressed as DTX1 or ETC1.
  The same happens with the 'Cb', 'Cr' and optionally 'Alpha' channels.
- All channels are then LZ4 compressed together.
+ All channels are then LZ4 ( or zstd ) compressed together.
 */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <knib_read.h>
 #include <libimg.h>
 #include <libimgutil.h>
@@ -20,27 +24,84 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
 #include "lz4.h"
 #include "lz4hc.h"
 #include "args.h"
+#include "Codec.hpp"
 
 #include "Image.hpp"
 #include "ImageReader.hpp"
+#include "PipeReader.hpp"
 #include "PlanarWorkSet.hpp"
 #include "PackedWorkSet.hpp"
 #include "SetAssembler.hpp"
 #include "KnibFile.hpp"
 #include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+// number of frames in the input range, used to size the output file up front.
+static int ExpectedFrames(const arguments & args) {
+
+	return abs(args.ff_to - args.ff_from) / std::max(abs(args.ff_inc), 1) + 1;
+}
 
-static int main_packed(arguments args) {
+// Describes the input frames in 'img', opening the input stream first if it is one.
+static int StatInput(imgImage ** img, const arguments & args, std::unique_ptr<PipeReader> & pipe) {
+
+	if(!args.y4m && !args.rgba_width)
+		return imgAllocAndStatF(img, args.ff_string, args.ff_from);
+
+	try {
+		pipe = std::unique_ptr<PipeReader>( new PipeReader(
+			args.ff_string, args.y4m, args.rgba_width, args.rgba_height, args.lookahead) );
+	}
+	catch(const std::exception & e) {
+		printf("ERROR: %s\n", e.what());
+		return -1;
+	}
+
+	if(imgAllocImage(img) != 0)
+		return -1;
+
+	(*img)->width = pipe->Width();
+	(*img)->height = pipe->Height();
+	(*img)->format = pipe->Format();
+
+	return 0;
+}
+
+// The input stream, or a reader for the input files.
+static std::unique_ptr<FrameSource> OpenInput(const arguments & args, std::unique_ptr<PipeReader> & pipe) {
+
+	if(pipe)
+		return std::move(pipe);
+
+	return std::unique_ptr<FrameSource>( new ImageReader(
+		args.ff_string, args.ff_from, args.ff_to, args.ff_inc, args.lookahead, args.reader_threads) );
+}
+
+static int main_packed(arguments args, const Codec & codec) {
 
 	// fix expected common mistake... from 10, to 1, increment 1.
 	//	change increment to -1.
 	if((args.ff_from > args.ff_to) && (args.ff_inc > 0))
 		args.ff_inc *= -1;
 
+	if(args.y4m) {
+		printf("Y4M input needs the planar format.\n");
+		return -1;
+	}
+
+	if(args.flags & (KNIB_DATA_DELTA | KNIB_DATA_DICT)) {
+		printf("--delta and --dict need the planar format.\n");
+		return -1;
+	}
+
+	std::unique_ptr<PipeReader> pipe;
+
 	imgImage * img = NULL;
-	if( imgAllocAndStatF(&img, args.ff_string , args.ff_from) == 0) {
+	if( StatInput(&img, args, pipe) == 0) {
 
 		std::shared_ptr<KnibFile> knibFile( new KnibFile(args.output_fn) );
 
@@ -57,8 +118,6 @@ static int main_packed(arguments args) {
 		else
 			printf("No alpha channel.\n");
 
-		const bool do_lz4 = (args.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4;
-
 		knibFile->SetFlags( args.flags );
 
 		imgFormat textureFmt;
@@ -77,11 +136,24 @@ static int main_packed(arguments args) {
 			break;
 		}
 
+		if(args.target_bitrate > 0)
+			printf("--target-bitrate is ignored for the packed format.\n");
+
+		// DXT1 and ETC1 are 4 bits per pixel, so before LZ4 each frame needs
+		//  half a byte per pixel for RGB, and the same again for alpha.
+		// There's no telling how long a pipe is.
+		if(!pipe)
+			knibFile->Reserve( (int64_t)ExpectedFrames(args) * img->width * img->height / 2 * (alpha ? 2 : 1) );
+
+		bool failed = false;
 		{
 			// TODO: assuming 8 threads is a good balance.
 			int threads = 8;
 
-			ImageReader imageReader(args.ff_string, args.ff_from, args.ff_to, args.ff_inc, 3);
+			// by default, the sets being encoded at once share the cores between their strips.
+			int strip_threads = args.strip_threads ? args.strip_threads : std::max(1, (int)std::thread::hardware_concurrency() / threads);
+
+			std::unique_ptr<FrameSource> imageReader = OpenInput(args, pipe);
 
 			ThreadPool<PackedWorkSet> threadPool(knibFile, threads);
 
@@ -89,7 +161,7 @@ static int main_packed(arguments args) {
 			int frames = 0;
 			int set_index = 0;
 
-			while((images[frames%3] = std::move(imageReader.NextImage()))) {
+			while(!threadPool.Failed() && (images[frames%3] = std::move(imageReader->NextImage()))) {
 
 				++frames;
 
@@ -100,9 +172,11 @@ static int main_packed(arguments args) {
 							img->width,
 							img->height,
 							alpha,
-							do_lz4,
+							codec,
 							textureFmt,
 							args.quality,
+							strip_threads,
+							args.max_set_size,
 							set_index++)));
 				}
 			}
@@ -113,9 +187,11 @@ static int main_packed(arguments args) {
 					img->width,
 					img->height,
 					alpha,
-					do_lz4,
+					codec,
 					textureFmt,
 					args.quality,
+					strip_threads,
+					args.max_set_size,
 					set_index++)));
 			}
 
@@ -123,9 +199,23 @@ static int main_packed(arguments args) {
 
 			threadPool.NoMoreWork();
 
+			failed = !threadPool.Finish() || imageReader->Failed();
+
+			if(!failed && !frames) {
+				printf("ERROR: no frames on input.\n");
+				failed = true;
+			}
+
 			knibFile->SetFrames(frames);
 		}
 
+		if(failed) {
+			knibFile.reset();
+			remove(args.output_fn);
+			printf("ERROR: encoding failed, %s removed.\n", args.output_fn);
+			return -1;
+		}
+
 		return 0;
 	}
 
@@ -136,15 +226,25 @@ static int main_packed(arguments args) {
 	return -1;
 }
 
-static int main_planar(arguments args) {
+static int main_planar(arguments args, const Codec & codec) {
 
 	// fix expected common mistake... from 10, to 1, increment 1.
 	//	change increment to -1.
 	if((args.ff_from > args.ff_to) && (args.ff_inc > 0))
 		args.ff_inc *= -1;
 
+	std::unique_ptr<PipeReader> pipe;
+
 	imgImage * img = NULL;
-	if( imgAllocAndStatF(&img, args.ff_string , args.ff_from) == 0) {
+	if( StatInput(&img, args, pipe) == 0) {
+
+		// RGB frames are stretched to the texture size, but 4:2:0 frames could only be padded,
+		//  and the file doesn't say which. So Y4M frames have to be the texture size already.
+		if(args.y4m && (img->width % 8 || img->height % 8)) {
+			printf("ERROR: Y4M frames must be a multiple of 8 pixels wide and high, not %dx%d.\n", img->width, img->height);
+			imgFreeAll(img);
+			return -1;
+		}
 
 		std::shared_ptr<KnibFile> knibFile( new KnibFile(args.output_fn) );
 
@@ -161,8 +261,6 @@ static int main_planar(arguments args) {
 		else
 			printf("No alpha channel.\n");
 
-		const bool do_lz4 = (args.flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4;
-
 		knibFile->SetFlags( args.flags );
 
 		imgFormat textureFmt;
@@ -181,11 +279,30 @@ static int main_planar(arguments args) {
 			break;
 		}
 
+		// DXT1 and ETC1 are 4 bits per pixel, so before LZ4 each set of 3 frames needs
+		//  3/4 of a byte per pixel for Y, Cb and Cr, and another 1/2 for alpha.
+		// There's no telling how long a pipe is.
+		if(!pipe)
+			knibFile->Reserve( (int64_t)(ExpectedFrames(args) + 2) / 3 * img->width * img->height * (alpha ? 5 : 3) / 4 );
+
+		bool failed = false;
 		{
 			// TODO: assuming 8 threads is a good balance.
 			int threads = 8;
 
-			ImageReader imageReader(args.ff_string, args.ff_from, args.ff_to, args.ff_inc, 3);
+			// by default, the sets being encoded at once share the cores between their strips.
+			int strip_threads = args.strip_threads ? args.strip_threads : std::max(1, (int)std::thread::hardware_concurrency() / threads);
+
+			std::unique_ptr<FrameSource> imageReader = OpenInput(args, pipe);
+
+			std::shared_ptr<RateControl> rate;
+			if(args.target_bitrate > 0)
+				rate = std::shared_ptr<RateControl>( new RateControl(
+					args.target_bitrate, args.fps, 3, args.quality, args.rate_log) );
+
+			std::shared_ptr<DeltaChain> delta;
+			if(args.flags & (KNIB_DATA_DELTA | KNIB_DATA_DICT))
+				delta = std::shared_ptr<DeltaChain>( new DeltaChain(args.key_interval, !!(args.flags & KNIB_DATA_DICT)) );
 
 			ThreadPool<PlanarWorkSet> threadPool(knibFile, threads);
 
@@ -193,7 +310,7 @@ static int main_planar(arguments args) {
 			int frames = 0;
 			int set_index = 0;
 
-			while((images[frames%3] = std::move(imageReader.NextImage()))) {
+			while(!threadPool.Failed() && (images[frames%3] = std::move(imageReader->NextImage()))) {
 
 				++frames;
 
@@ -204,9 +321,13 @@ static int main_planar(arguments args) {
 							img->width,
 							img->height,
 							alpha,
-							do_lz4,
+							codec,
 							textureFmt,
 							args.quality,
+							strip_threads,
+							rate,
+							args.max_set_size,
+							delta,
 							set_index++)));
 				}
 			}
@@ -217,9 +338,13 @@ static int main_planar(arguments args) {
 					img->width,
 					img->height,
 					alpha,
-					do_lz4,
+					codec,
 					textureFmt,
 					args.quality,
+					strip_threads,
+					rate,
+					args.max_set_size,
+					delta,
 					set_index++)));
 			}
 
@@ -227,9 +352,23 @@ static int main_planar(arguments args) {
 
 			threadPool.NoMoreWork();
 
+			failed = !threadPool.Finish() || imageReader->Failed();
+
+			if(!failed && !frames) {
+				printf("ERROR: no frames on input.\n");
+				failed = true;
+			}
+
 			knibFile->SetFrames(frames);
 		}
 
+		if(failed) {
+			knibFile.reset();
+			remove(args.output_fn);
+			printf("ERROR: encoding failed, %s removed.\n", args.output_fn);
+			return -1;
+		}
+
 		return 0;
 	}
 
@@ -244,16 +383,36 @@ int main(int argc, char * argv[]) {
 
 	arguments args = read_args(argc,argv);
 
+	Image::BuiltinEncoders() = !args.imgutil;
+
+	if(args.trace_fn) {
+		if(!Trace::Instance().Open(args.trace_fn))
+			return -1;
+		Trace::Instance().ThreadName("main");
+	}
+
 	// default planar.
 	if((args.flags & KNIB_CHANNELS_MASK) == 0)
 		args.flags |= KNIB_CHANNELS_PLANAR;
 
+	std::unique_ptr<Codec> codec;
+	try {
+		codec = std::unique_ptr<Codec>( new Codec(args.flags, args.level, args.min_ratio) );
+	}
+	catch(const std::exception & e) {
+		printf("ERROR: %s\n", e.what());
+		return -1;
+	}
+
+	int ret;
 	if((args.flags & KNIB_CHANNELS_MASK) == KNIB_CHANNELS_PLANAR)
-		return main_planar( args );
+		ret = main_planar( args, *codec );
 	else
-		return main_packed( args );
+		ret = main_packed( args, *codec );
 
-	return -1;
+	Trace::Instance().Close();
+
+	return ret;
 }
 
 
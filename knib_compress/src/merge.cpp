@@ -0,0 +1,90 @@
+/*
+ knib_merge - joins Knib files encoded from consecutive frame ranges into one, without re-encoding.
+
+ knib_merge OUTPUT_FILE INPUT_FILE...
+
+ Inputs are joined in the order given, and must share a format and frame size.
+ Sets hold 3 frames, so every input but the last must hold a multiple of 3 frames
+ ( encode with --from-frame/--to-frame ranges aligned to 3 frames ).
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <knib_read.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "KnibFile.hpp"
+#include "KnibInput.hpp"
+
+// flags that must match for files to be joined.
+// ( the first set of every delta or dictionary coded input is a key set, so they can be joined as they are )
+static const int format_flags = KNIB_CHANNELS_MASK | KNIB_DATA_MASK | KNIB_DATA_DELTA | KNIB_DATA_DICT | KNIB_DATA_SHUFFLE | KNIB_TEX_MASK;
+
+int main(int argc, char * argv[]) {
+
+	if(argc < 3) {
+		printf("usage: knib_merge OUTPUT_FILE INPUT_FILE...\n");
+		return -1;
+	}
+
+	try {
+		// check every input before writing anything.
+		knib_header first;
+		memset(&first, 0, sizeof first);
+		int frames = 0;
+
+		for(int i=2;i<argc;i++) {
+
+			KnibInput input(argv[i]);
+			const knib_header & header = input.Header();
+
+			if(i == 2)
+				first = header;
+			else if( (header.flags & format_flags) != (first.flags & format_flags) ||
+					 header.frame_width != first.frame_width ||
+					 header.frame_height != first.frame_height )
+			{
+				printf("ERROR: %s doesn't match the format of %s\n", argv[i], argv[2]);
+				return -1;
+			}
+
+			if( (frames % 3) != 0 ) {
+				printf("ERROR: %s doesn't hold a multiple of 3 frames, only the last input may.\n", argv[i-1]);
+				return -1;
+			}
+
+			printf("%s: %d frames\n", argv[i], header.frames);
+
+			frames += header.frames;
+		}
+
+		KnibFile knibFile(argv[1]);
+
+		knibFile.SetFlags( first.flags & ~(KNIB_INDEXED | KNIB_ALPHA) );
+		knibFile.SetSize( first.frame_width, first.frame_height );
+		knibFile.SetFrames(frames);
+
+		for(int i=2;i<argc;i++) {
+
+			KnibInput input(argv[i]);
+
+			std::shared_ptr<KnibSet> set;
+			while( (set = input.NextSet()) )
+				if(!knibFile.OutputSet(set))
+					throw std::runtime_error("output error!");
+		}
+
+		printf("%d frames written to %s\n", frames, argv[1]);
+	}
+	catch(const std::exception & e) {
+		printf("ERROR: %s\n", e.what());
+		return -1;
+	}
+
+	return 0;
+}
@@ -1,8 +1,15 @@
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+
+// Version 2 and 3 file header. ( older versions are converted on load, see 'knib_header_v0' )
 struct knib_header {
 
 	char magick[4]; // must be "knib"
-	int version; // must be 0
+	int version; // 0 to 3 ( see 'knib_set_header' )
 	int flags; // see 'knib_header_flags'
 	int orig_width; // width of the input media.
 	int orig_height; // height of the input media.
@@ -12,149 +19,1537 @@ struct knib_header {
 	int framerate; // TODO: frames per second, or seconds per frame?
 	int compressed_buffer_size; // size of the buffer required to hold the largest compressed set.
 	int uncompressed_buffer_size; // size of the buffer required to hold the largest uncompressed set.
-	int first_set_offset; // offset of the first 'knib_set_header'
+	int sets; // number of entries in the set index.
+	int64_t first_set_offset; // offset of the first 'knib_set_header'
+	int64_t set_index_offset; // offset of the set index. ( only valid if KNIB_INDEXED is set )
+};
+
+// Version 0 and 1 file header.
+struct knib_header_v0 {
+
+	char magick[4];
+	int version;
+	int flags;
+	int orig_width;
+	int orig_height;
+	int frame_width;
+	int frame_height;
+	int frames;
+	int framerate;
+	int compressed_buffer_size;
+	int uncompressed_buffer_size;
+	int first_set_offset;
+	int set_index_offset;
+	int sets;
 };
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "lz4.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "knib_read.h"
+
+// Version 3 set header. ( version 2 is a prefix of version 3 )
+struct knib_set_header {
+
+	int64_t data_offset; // file offset of this sets data.
+	int64_t next_set_offset; // file offset of the next
+
+	int data_size; // file size of this sets data.
+	int data_uncompressed_size; // size of this sets data once uncompressed.
+
+	int y_data_buffer_offset; // 'Y' data offset in the uncompressed buffer.
+	int y_data_buffer_size; // 'Y' data size in the uncompressed buffer.
+	int cb_data_buffer_offset; // 'Cb' data offset in the uncompressed buffer.
+	int cb_data_buffer_size;// 'Cb' data size in the uncompressed buffer.
+	int cr_data_buffer_offset;// 'Cr' data offset in the uncompressed buffer.
+	int cr_data_buffer_size;// 'Cr' data size in the uncompressed buffer.
+	int a_data_buffer_offset;// 'A' data offset in the uncompressed buffer.
+	int a_data_buffer_size;// 'A' data size in the uncompressed buffer.
+
+	// Each plane is compressed as an independent block.
+	int y_data_compressed_offset; // 'Y' block offset in this sets data.
+	int y_data_compressed_size; // 'Y' block size in this sets data.
+	int cb_data_compressed_offset; // 'Cb' block offset in this sets data.
+	int cb_data_compressed_size; // 'Cb' block size in this sets data.
+	int cr_data_compressed_offset; // 'Cr' block offset in this sets data.
+	int cr_data_compressed_size; // 'Cr' block size in this sets data.
+	int a_data_compressed_offset; // 'A' block offset in this sets data.
+	int a_data_compressed_size; // 'A' block size in this sets data.
+
+	// Version 3 only.
+	int flags; // see 'knib_set_flags'
+	int reserved; // zero.
+};
+
+// Files whose sets build on the set before, rather than standing alone. ( see '_rebuild_set' )
+#define KNIB_DATA_CHAINED (KNIB_DATA_DELTA | KNIB_DATA_DICT)
+
+// size of a version 2 'knib_set_header' on disk.
+#define KNIB_SET_HEADER_SIZE_V2 ((int)offsetof(struct knib_set_header, flags))
+
+// Version 0 and 1 set header.
+struct knib_set_header_v1 {
+
+	int data_offset;
+	int data_size;
+	int data_uncompressed_size;
+
+	int y_data_buffer_offset;
+	int y_data_buffer_size;
+	int cb_data_buffer_offset;
+	int cb_data_buffer_size;
+	int cr_data_buffer_offset;
+	int cr_data_buffer_size;
+	int a_data_buffer_offset;
+	int a_data_buffer_size;
+
+	int next_set_offset;
+
+	// Version 1 only. ( version 0 files compress all planes as a single block )
+	int y_data_compressed_offset;
+	int y_data_compressed_size;
+	int cb_data_compressed_offset;
+	int cb_data_compressed_size;
+	int cr_data_compressed_offset;
+	int cr_data_compressed_size;
+	int a_data_compressed_offset;
+	int a_data_compressed_size;
+};
+
+// size of a version 0 'knib_set_header_v1' on disk.
+#define KNIB_SET_HEADER_SIZE_V0 ((int)offsetof(struct knib_set_header_v1, y_data_compressed_offset))
+
+// Version 2 set index entry.
+struct knib_set_index_entry {
+
+	int64_t set_offset; // file offset of this sets 'knib_set_header'
+	int64_t set_size; // file size of this sets header and data.
+};
+
+// Version 0 and 1 set index entry.
+struct knib_set_index_entry_v0 {
+
+	int set_offset;
+	int set_size;
+};
+
+// A block decompressor, for one of the 'KNIB_DATA_MASK' values.
+struct knib_codec {
+
+	int data; // KNIB_DATA_LZ4, ...
+	const char * name;
+
+	// decompresses 'src_size' bytes into exactly 'dst_size' bytes, returns 0 on success.
+	int (*decode)(const char * src, int src_size, char * dst, int dst_size);
+};
+
+static int _lz4_decode(const char * src, int src_size, char * dst, int dst_size) {
+
+	return (LZ4_uncompress( src, dst, dst_size ) == src_size) ? 0 : -1;
+}
+
+#ifdef HAVE_ZSTD_H
+static int _zstd_decode(const char * src, int src_size, char * dst, int dst_size) {
+
+	return (ZSTD_decompress( dst, dst_size, src, src_size ) == (size_t)dst_size) ? 0 : -1;
+}
+#endif
+
+// compressions this build can read. ( KNIB_DATA_PLAIN needs no codec )
+static const struct knib_codec _codecs[] = {
+	{ KNIB_DATA_LZ4,  "LZ4",  &_lz4_decode },
+#ifdef HAVE_ZSTD_H
+	{ KNIB_DATA_ZSTD, "zstd", &_zstd_decode },
+#endif
+};
+
+static const struct knib_codec * _find_codec(int flags) {
+
+	int i;
+
+	for(i=0; i<(int)(sizeof _codecs / sizeof _codecs[0]); i++)
+		if(_codecs[i].data == (flags & KNIB_DATA_MASK))
+			return &_codecs[i];
+	return NULL;
+}
+
+#define KNIB_ASYNC_SLOTS 3 // the current set, plus 2 sets of read-ahead.
+
+struct knib_slot {
+
+	struct knib_set_header set;
+	void * read_buffer;
+	void * decode_buffer;
+	void * shuffle_buffer;
+	void * data; // the sets plane data, in either 'read_buffer' or 'decode_buffer'.
+	int    set_number; // index of the set held in this slot.
+	int    error; // non-zero if the set couldn't be loaded.
+	int    dirty_offset[4]; // KNIB_DATA_CHAINED: bytes of each plane changed since the set before.
+	int    dirty_size[4];
+};
+
+struct knib_async {
+
+	pthread_t       thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+
+	struct knib_slot slots[KNIB_ASYNC_SLOTS];
+	int cur; // slot currently exposed through 'knib_context'.
+	int filled; // number of decoded slots after 'cur'.
+
+	int next_set; // set the worker will load next.
+	int64_t next_set_offset; // file offset of 'next_set', or -1 if unknown.
+	int generation; // incremented on seek, stale work is discarded.
+	int stalled; // worker hit an error, and waits for a seek.
+	int loading; // worker is loading a set, without the lock. ( see '_async_pause' )
+	int quit;
+
+	// KNIB_DATA_CHAINED: the workers own copy of the last set it rebuilt.
+	void * chain_buffer;
+	int chain_set;
+};
+
+// read only view of a memory mapped file, used as the 'stream' by 'knib_open_mmap'.
+struct knib_mmap_stream {
+
+	char *  base;
+	int64_t size;
+	int64_t pos;
+};
+
+struct knib_context {
+
+	int is_custom_io;
+
+	knib_read read_func;
+	knib_seek seek_func;
+	knib_seek64 seek64_func; // used in place of 'seek_func' if set.
+	void * stream;
+
+	int    version;
+	int    flags;
+	const struct knib_codec * codec; // NULL for plain data.
+	int    planes; // see 'knib_planes'
+	int    decode_threads;
+	struct knib_decode_pool * pool; // decode_threads-1 threads, NULL for 1.
+	int64_t first_set;
+	int    tex_width;
+	int    tex_height;
+	void * read_buffer;
+	int    read_buffer_size;
+	void * decode_buffer;
+	int    decode_buffer_size;
+	void * shuffle_buffer; // KNIB_DATA_SHUFFLE: planes decode here, then unshuffle into the decode buffer.
+	void * cur_data; // current sets plane data. ( read_buffer, decode_buffer or the mmap )
+	int    cur_frame;
+	int    unchanged; // the current frame uses the same set data as the last. ( see 'knib_textures_unchanged' )
+	int    frames;
+
+	// KNIB_DATA_CHAINED: sets are rebuilt in 'chain_buffer' on top of the set before.
+	void * chain_buffer;
+	int    chain_set; // set held in 'chain_buffer', -1 for none.
+	int    dirty_offset[4]; // bytes of each plane changed since the set before.
+	int    dirty_size[4];
+	int    sets;
+
+	struct knib_set_index_entry * set_index;
+
+	struct knib_set_header cur_set;
+
+	struct knib_async * async; // NULL unless opened with 'knib_open_file_async'
+
+	struct knib_mmap_stream * map; // NULL unless opened with 'knib_open_mmap'
+};
+
+static int _is_a_knib_stream(struct knib_context * ctx) {
+
+	char magick[4];
+	if((*ctx->read_func)(magick, sizeof magick, 1, ctx->stream) ==1) {
+
+		if(memcmp(magick,"knib",4)==0)
+			return 0;
+		else
+			printf("bad magick\n\n");
+	}
+	printf("not a knib stream\n");
+	return -1;
+}
+
+static size_t _mmap_read(void *ptr, size_t size, size_t nmemb, void *stream) {
+
+	struct knib_mmap_stream * map = (struct knib_mmap_stream *)stream;
+	size_t n = 0;
+
+	while(n < nmemb && map->pos + (int64_t)size <= map->size) {
+		memcpy((char*)ptr + n * size, map->base + map->pos, size);
+		map->pos += size;
+		n++;
+	}
+	return n;
+}
+
+static int _mmap_seek(void *stream, int64_t offset, int whence) {
+
+	struct knib_mmap_stream * map = (struct knib_mmap_stream *)stream;
+	int64_t pos;
+
+	switch(whence) {
+		case SEEK_SET: pos = offset; break;
+		case SEEK_CUR: pos = map->pos + offset; break;
+		case SEEK_END: pos = map->size + offset; break;
+		default: return -1;
+	}
+	if(pos < 0 || pos > map->size)
+		return -1;
+
+	map->pos = pos;
+	return 0;
+}
+
+static int _file_seek(void *stream, int64_t offset, int whence) {
+
+	return fseeko((FILE*)stream, (off_t)offset, whence);
+}
+
+static int _seek(struct knib_context * ctx, int64_t offset) {
+
+	if(ctx->seek64_func)
+		return (*ctx->seek64_func)(ctx->stream, offset, SEEK_SET);
+
+	if(offset != (long)offset)
+		return -1; // beyond the reach of the 'knib_seek' callback.
+
+	return (*ctx->seek_func)(ctx->stream, (long)offset, SEEK_SET);
+}
+
+// planes are decoded, or used, at their buffer offsets, so they must lie within the sets data.
+// Decoded sets must fit the decode buffer, sets used as they were read must fit their data.
+static int _check_set_header(struct knib_context * ctx, const struct knib_set_header * set) {
+
+	const int offset[4] = {
+		set->y_data_buffer_offset, set->cb_data_buffer_offset,
+		set->cr_data_buffer_offset, set->a_data_buffer_offset };
+	const int size[4] = {
+		set->y_data_buffer_size, set->cb_data_buffer_size,
+		set->cr_data_buffer_size, set->a_data_buffer_size };
+	const int data = set->flags & KNIB_SET_DATA_MASK;
+	const int decoded = (data ? data != KNIB_DATA_PLAIN : ctx->codec != NULL) || (ctx->flags & KNIB_DATA_CHAINED);
+	int i;
+
+	if(set->data_uncompressed_size < 0 ||
+		set->data_uncompressed_size > (decoded ? ctx->decode_buffer_size : set->data_size)) {
+		printf("bad set size\n");
+		return -1; // BAD KNIB FILE!
+	}
+
+	for(i=0; i<4; i++)
+		if(offset[i] < 0 || size[i] < 0 || size[i] > set->data_uncompressed_size - offset[i]) {
+			printf("bad plane buffer\n");
+			return -1; // BAD KNIB FILE!
+		}
+
+	return 0;
+}
+
+static int _read_set_header(struct knib_context * ctx, int64_t set_offset, struct knib_set_header * set) {
+
+	if(_seek(ctx, set_offset) != 0) {
+		printf("couldn't seek to set @ %lld\n", (long long)set_offset);
+		return -1;
+	}
+
+	if(ctx->version >= 2) {
+		// version 2 is a prefix of version 3.
+		memset(set, 0, sizeof *set);
+		if(((*ctx->read_func)(set, ctx->version == 2 ? KNIB_SET_HEADER_SIZE_V2 : sizeof *set, 1, ctx->stream) != 1)) {
+			printf("couldn't read set @ %lld\n", (long long)set_offset);
+			return -1;
+		}
+	}
+	else {
+		// version 0 is a prefix of version 1.
+		struct knib_set_header_v1 v1;
+
+		memset(set, 0, sizeof *set);
+		memset(&v1, 0, sizeof v1);
+		if(((*ctx->read_func)(&v1, ctx->version == 0 ? KNIB_SET_HEADER_SIZE_V0 : sizeof v1, 1, ctx->stream) != 1)) {
+			printf("couldn't read set @ %lld\n", (long long)set_offset);
+			return -1;
+		}
+
+		set->data_offset               = v1.data_offset;
+		set->next_set_offset           = v1.next_set_offset;
+		set->data_size                 = v1.data_size;
+		set->data_uncompressed_size    = v1.data_uncompressed_size;
+		set->y_data_buffer_offset      = v1.y_data_buffer_offset;
+		set->y_data_buffer_size        = v1.y_data_buffer_size;
+		set->cb_data_buffer_offset     = v1.cb_data_buffer_offset;
+		set->cb_data_buffer_size       = v1.cb_data_buffer_size;
+		set->cr_data_buffer_offset     = v1.cr_data_buffer_offset;
+		set->cr_data_buffer_size       = v1.cr_data_buffer_size;
+		set->a_data_buffer_offset      = v1.a_data_buffer_offset;
+		set->a_data_buffer_size        = v1.a_data_buffer_size;
+		set->y_data_compressed_offset  = v1.y_data_compressed_offset;
+		set->y_data_compressed_size    = v1.y_data_compressed_size;
+		set->cb_data_compressed_offset = v1.cb_data_compressed_offset;
+		set->cb_data_compressed_size   = v1.cb_data_compressed_size;
+		set->cr_data_compressed_offset = v1.cr_data_compressed_offset;
+		set->cr_data_compressed_size   = v1.cr_data_compressed_size;
+		set->a_data_compressed_offset  = v1.a_data_compressed_offset;
+		set->a_data_compressed_size    = v1.a_data_compressed_size;
+	}
+
+	return _check_set_header(ctx, set);
+}
+
+// reads a sets data, or locates it in the mapping.
+static int _read_set_data(struct knib_context * ctx, const struct knib_set_header * set, void * read_buffer, char ** data) {
+
+	if(set->data_size > ctx->read_buffer_size) {
+		printf("buffer not big enough!\n");
+		return -1; // BAD KNIB FILE!
+	}
+
+	if(ctx->map) {
+
+		// Mapped files are decoded from, or used in place of, the mapping.
+		if(set->data_offset < 0 || set->data_size < 0 || set->data_offset + set->data_size > ctx->map->size) {
+			printf("set data truncated\n");
+			return -1; // TRUNCATED KNIB FILE!?
+		}
+		*data = ctx->map->base + set->data_offset;
+		return 0;
+	}
+
+	if(_seek(ctx, set->data_offset) != 0) {
+		printf("cant seek to cur set data\n");
+		return -1;
+	}
+
+	if((*ctx->read_func)( read_buffer, set->data_size, 1, ctx->stream ) != 1) {
+		printf("set data truncated\n");
+		printf("read %d bytes from offset %lld\n", set->data_size, (long long)set->data_offset);
+		return -1; // TRUNCATED KNIB FILE!?
+	}
+
+	*data = read_buffer;
+	return 0;
+}
+
+struct knib_plane_job {
+
+	const char * src;
+	int          src_size;
+	char *       dst;
+	int          dst_size;
+	int          result;
+	char *       shuffled; // KNIB_DATA_SHUFFLE: where the plane decodes before it's unshuffled into 'dst', or NULL.
+	const struct knib_codec * codec;
+	const char * dict; // KNIB_DATA_DICT: the same plane of the set before, or NULL.
+	int          pending; // queued on, or being decoded by, the pool.
+	struct knib_plane_job * next; // next job queued on the pool.
+};
+
+#define KNIB_MAX_DECODE_THREADS 4
+
+// Threads that decode planes for '_decode_planes', started once rather than for every set.
+// The calling thread and the async worker may both queue jobs on it.
+struct knib_decode_pool {
+
+	pthread_t       thread[KNIB_MAX_DECODE_THREADS-1];
+	int             threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t  work; // a job was queued, or 'quit'.
+	pthread_cond_t  done; // a job finished.
+	struct knib_plane_job * queue; // jobs not started yet.
+	int quit;
+};
+
+// KNIB_DATA_DICT: a plane is a table of chunk sizes, then its chunks.
+// Each chunk is LZ4 compressed with the same chunk of the set before as its dictionary.
+static int _decode_chunks(const char * src, int src_size, char * dst, int dst_size, const char * dict) {
+
+	const int chunks = (dst_size + KNIB_DICT_CHUNK_SIZE - 1) / KNIB_DICT_CHUNK_SIZE;
+	int block = chunks * (int)sizeof(int);
+	int i;
+
+	if(src_size < block)
+		return -1;
+
+	for(i=0; i<chunks; i++) {
+
+		const int offset = i * KNIB_DICT_CHUNK_SIZE;
+		const int size = (dst_size - offset < KNIB_DICT_CHUNK_SIZE) ? dst_size - offset : KNIB_DICT_CHUNK_SIZE;
+		int block_size;
+
+		memcpy(&block_size, src + i * sizeof(int), sizeof block_size);
+
+		if(block_size < 0 || block + block_size > src_size)
+			return -1;
+
+		if(LZ4_decompress_fast_usingDict( src + block, dst + offset, size, dict + offset, size ) != block_size)
+			return -1;
+
+		block += block_size;
+	}
+
+	return (block == src_size) ? 0 : -1;
+}
+
+// KNIB_DATA_SHUFFLE: a plane holds the first 4 bytes of each 8 byte texture block, then the last 4.
+// ( DXT1 colours then indices, ETC1 base colours and modes then indices )
+// Interleaves them back into 'dst'. Trailing bytes that aren't a whole block are stored as they are.
+static void _unshuffle_blocks(char * dst, const char * src, int size) {
+
+	const int blocks = size / 8;
+	const char * head = src;
+	const char * tail = src + blocks * 4;
+	int i = 0;
+
+#if defined(__SSE2__)
+	for(; i+4<=blocks; i+=4) {
+
+		const __m128i h = _mm_loadu_si128((const __m128i *)(head + i * 4));
+		const __m128i t = _mm_loadu_si128((const __m128i *)(tail + i * 4));
+
+		_mm_storeu_si128((__m128i *)(dst + i * 8), _mm_unpacklo_epi32(h, t));
+		_mm_storeu_si128((__m128i *)(dst + i * 8 + 16), _mm_unpackhi_epi32(h, t));
+	}
+#elif defined(__ARM_NEON)
+	for(; i+4<=blocks; i+=4) {
+
+		const uint32x4x2_t z = vzipq_u32(
+			vld1q_u32((const uint32_t *)(head + i * 4)),
+			vld1q_u32((const uint32_t *)(tail + i * 4)));
+
+		vst1q_u32((uint32_t *)(dst + i * 8), z.val[0]);
+		vst1q_u32((uint32_t *)(dst + i * 8 + 16), z.val[1]);
+	}
+#endif
+
+	for(; i<blocks; i++) {
+		memcpy(dst + i * 8, head + i * 4, 4);
+		memcpy(dst + i * 8 + 4, tail + i * 4, 4);
+	}
+
+	memcpy(dst + blocks * 8, src + blocks * 8, size - blocks * 8);
+}
+
+static int _decode_block(struct knib_plane_job * job) {
+
+	int e;
+
+	if(job->dict)
+		return _decode_chunks( job->src, job->src_size, job->dst, job->dst_size, job->dict );
+
+	if(!job->shuffled)
+		return job->codec->decode( job->src, job->src_size, job->dst, job->dst_size );
+
+	if((e = job->codec->decode( job->src, job->src_size, job->shuffled, job->dst_size )) == 0)
+		_unshuffle_blocks( job->dst, job->shuffled, job->dst_size );
+
+	return e;
+}
+
+static void * _decode_plane(void * arg) {
+
+	struct knib_plane_job * job = (struct knib_plane_job *)arg;
+
+	if(_decode_block(job) == 0)
+		job->result = 0;
+	else {
+		printf("%s failed\n", job->codec->name);
+		job->result = -1; // BAD OR TRUNCATED KNIB FILE!
+	}
+	return NULL;
+}
+
+static void * _pool_thread(void * arg) {
+
+	struct knib_decode_pool * pool = (struct knib_decode_pool *)arg;
+	struct knib_plane_job * job;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	for(;;) {
+
+		while(!pool->quit && !pool->queue)
+			pthread_cond_wait(&pool->work, &pool->mutex);
+
+		if(pool->quit)
+			break;
+
+		job = pool->queue;
+		pool->queue = job->next;
+
+		pthread_mutex_unlock(&pool->mutex);
+		_decode_plane(job);
+		pthread_mutex_lock(&pool->mutex);
+
+		job->pending = 0;
+		pthread_cond_broadcast(&pool->done);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void _pool_stop(struct knib_decode_pool * pool) {
+
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for(i=0; i<pool->threads; i++)
+		pthread_join(pool->thread[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+static struct knib_decode_pool * _pool_start(int threads) {
+
+	struct knib_decode_pool * pool;
+
+	if(!(pool = calloc(1, sizeof(struct knib_decode_pool))))
+		return NULL;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for(; pool->threads < threads; pool->threads++)
+		if(pthread_create(&pool->thread[pool->threads], NULL, &_pool_thread, pool) != 0) {
+			printf("cant create decode thread\n");
+			_pool_stop(pool);
+			return NULL;
+		}
+
+	return pool;
+}
+
+// the codec 'set' was compressed with, NULL if it's plain.
+// Sets may be stored differently to the rest of the file. ( see KNIB_SET_DATA_MASK )
+static int _set_codec(struct knib_context * ctx, const struct knib_set_header * set, const struct knib_codec ** codec) {
+
+	const int data = set->flags & KNIB_SET_DATA_MASK;
+
+	if(!data)
+		*codec = ctx->codec;
+	else if(data == KNIB_DATA_PLAIN)
+		*codec = NULL;
+	else if(!(*codec = _find_codec(data))) {
+		printf("unsupported set compression\n");
+		return -1;
+	}
+	return 0;
+}
+
+// decodes a version 1+ sets planes into 'dst'. NULL planes, and planes not in 'ctx->planes' are skipped.
+// KNIB_DATA_DICT sets, other than key sets, give the set before as 'dict'. ( NULL otherwise )
+// KNIB_DATA_SHUFFLE sets decode each plane at its offset in 'shuffle_buffer' first, so planes decoded in parallel don't share it.
+static int _decode_planes(struct knib_context * ctx, const struct knib_set_header * set, const char * src, void * dst[4], const char * dict, char * shuffle_buffer) {
+
+	// don't bother with threads for planes smaller than this.
+	static const int min_threaded_plane_size = 64 * 1024;
+
+	const int src_offset[4] = {
+		set->y_data_compressed_offset, set->cb_data_compressed_offset,
+		set->cr_data_compressed_offset, set->a_data_compressed_offset };
+	const int src_size[4] = {
+		set->y_data_compressed_size, set->cb_data_compressed_size,
+		set->cr_data_compressed_size, set->a_data_compressed_size };
+	const int dst_offset[4] = {
+		set->y_data_buffer_offset, set->cb_data_buffer_offset,
+		set->cr_data_buffer_offset, set->a_data_buffer_offset };
+	const int dst_size[4] = {
+		set->y_data_buffer_size, set->cb_data_buffer_size,
+		set->cr_data_buffer_size, set->a_data_buffer_size };
+	// chained sets build on every plane of the set before.
+	const int planes = (ctx->flags & KNIB_DATA_CHAINED) ? KNIB_PLANES_ALL : ctx->planes;
+
+	struct knib_decode_pool * pool = ctx->pool;
+	const struct knib_codec * codec;
+	struct knib_plane_job job[4];
+	int todo[4] = {0,0,0,0};
+	int first = -1;
+	int queued = 0;
+	int i, e = 0;
+
+	if(_set_codec(ctx, set, &codec) != 0 || !codec || ((ctx->flags & KNIB_DATA_SHUFFLE) && !shuffle_buffer))
+		return -1;
+
+	for(i=0; i<4; i++) {
+
+		job[i].src = src + src_offset[i];
+		job[i].src_size = src_size[i];
+		job[i].dst = dst[i];
+		job[i].dst_size = dst_size[i];
+		job[i].result = 0;
+		job[i].codec = codec;
+		job[i].shuffled = (ctx->flags & KNIB_DATA_SHUFFLE) ? shuffle_buffer + dst_offset[i] : NULL;
+		job[i].dict = dict ? dict + dst_offset[i] : NULL;
+		job[i].pending = 0;
+		job[i].next = NULL;
+
+		if(!dst[i] || !dst_size[i] || !(planes & (1<<i)))
+			continue;
+
+		if(src_offset[i] < 0 || src_size[i] < 0 || src_offset[i] + src_size[i] > set->data_size) {
+			printf("bad plane block\n");
+			return -1; // BAD KNIB FILE!
+		}
+
+		todo[i] = 1;
+
+		// the first plane is always decoded on the calling thread, big planes after it go to the pool.
+		if(first < 0)
+			first = i;
+		else if(pool && queued < pool->threads && dst_size[i] >= min_threaded_plane_size) {
+			job[i].pending = 1;
+			todo[i] = 0;
+			queued++;
+		}
+	}
+
+	if(queued) {
+		pthread_mutex_lock(&pool->mutex);
+		for(i=3; i>=0; i--)
+			if(job[i].pending) {
+				job[i].next = pool->queue;
+				pool->queue = &job[i];
+			}
+		pthread_cond_broadcast(&pool->work);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	for(i=0; i<4; i++)
+		if(todo[i])
+			_decode_plane(&job[i]);
+
+	if(queued) {
+		pthread_mutex_lock(&pool->mutex);
+		for(i=0; i<4; i++)
+			while(job[i].pending)
+				pthread_cond_wait(&pool->done, &pool->mutex);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	for(i=0; i<4; i++)
+		if(job[i].result)
+			e = -1;
+
+	return e;
+}
+
+static int _decode_set(struct knib_context * ctx, const struct knib_set_header * set, void * read_buffer, void * decode_buffer, void * shuffle_buffer, void ** data) {
+
+	const struct knib_codec * codec;
+	char * src;
+
+	if(_set_codec(ctx, set, &codec) != 0 || _read_set_data(ctx, set, read_buffer, &src) != 0)
+		return -1;
+
+	// plain sets are used where they were read, or mapped.
+	if(codec) {
+
+		if(ctx->version >= 1) {
+
+			void * dst[4] = {
+				((char *)decode_buffer) + set->y_data_buffer_offset,
+				((char *)decode_buffer) + set->cb_data_buffer_offset,
+				((char *)decode_buffer) + set->cr_data_buffer_offset,
+				((char *)decode_buffer) + set->a_data_buffer_offset };
+
+			if(_decode_planes(ctx, set, src, dst, NULL, shuffle_buffer) != 0)
+				return -1;
+		}
+		else if(codec->decode( src, set->data_size, decode_buffer, set->data_uncompressed_size ) != 0) {
+			printf("%s failed\n", codec->name);
+			return -1; // BAD OR TRUNCATED KNIB FILE!
+		}
+		*data = decode_buffer;
+	}
+	else
+		*data = src;
+
+	return 0;
+}
+
+// every byte of every plane changed.
+static void _all_dirty(const struct knib_set_header * set, int dirty_offset[4], int dirty_size[4]) {
+
+	dirty_offset[0] = dirty_offset[1] = dirty_offset[2] = dirty_offset[3] = 0;
+
+	dirty_size[0] = set->y_data_buffer_size;
+	dirty_size[1] = set->cb_data_buffer_size;
+	dirty_size[2] = set->cr_data_buffer_size;
+	dirty_size[3] = set->a_data_buffer_size;
+}
+
+// XORs a delta plane onto 'dst', and finds the range of bytes it changed.
+// Unchanged texture blocks are zero in the delta, and are skipped a block at a time.
+static void _xor_plane(char * dst, const char * src, int size, int * dirty_offset, int * dirty_size) {
+
+	int first = -1;
+	int last = -1;
+	int i;
+
+	for(i=0; i+8<=size; i+=8) {
+
+		uint64_t s, d;
+
+		memcpy(&s, src + i, 8);
+		if(!s)
+			continue;
+
+		memcpy(&d, dst + i, 8);
+		d ^= s;
+		memcpy(dst + i, &d, 8);
+
+		if(first < 0)
+			first = i;
+		last = i + 8;
+	}
+
+	for(; i<size; i++) {
+		if(src[i]) {
+			dst[i] ^= src[i];
+			if(first < 0)
+				first = i;
+			last = i + 1;
+		}
+	}
+
+	*dirty_offset = (first < 0) ? 0 : first;
+	*dirty_size = (first < 0) ? 0 : last - first;
+}
+
+// copies a plane over 'dst', and finds the range of bytes it changed.
+static void _update_plane(char * dst, const char * src, int size, int * dirty_offset, int * dirty_size) {
+
+	int first = -1;
+	int last = -1;
+	int i;
+
+	for(i=0; i+8<=size; i+=8) {
+
+		if(memcmp(dst + i, src + i, 8) == 0)
+			continue;
+
+		memcpy(dst + i, src + i, 8);
+		if(first < 0)
+			first = i;
+		last = i + 8;
+	}
+
+	for(; i<size; i++) {
+		if(dst[i] != src[i]) {
+			dst[i] = src[i];
+			if(first < 0)
+				first = i;
+			last = i + 1;
+		}
+	}
+
+	*dirty_offset = (first < 0) ? 0 : first;
+	*dirty_size = (first < 0) ? 0 : last - first;
+}
+
+// KNIB_DATA_CHAINED: decodes a set into 'ref', which holds the set before. Key sets replace it.
+// KNIB_DATA_DELTA sets are XORed onto it, KNIB_DATA_DICT sets are decompressed with it as their dictionary.
+static int _apply_set(struct knib_context * ctx, const struct knib_set_header * set, void * read_buffer, void * scratch, void * shuffle_buffer, char * ref, int dirty_offset[4], int dirty_size[4]) {
+
+	const int offset[4] = {
+		set->y_data_buffer_offset, set->cb_data_buffer_offset,
+		set->cr_data_buffer_offset, set->a_data_buffer_offset };
+	const int size[4] = {
+		set->y_data_buffer_size, set->cb_data_buffer_size,
+		set->cr_data_buffer_size, set->a_data_buffer_size };
+	void * data;
+	int i;
+
+	if(set->data_uncompressed_size > ctx->decode_buffer_size) {
+		printf("buffer not big enough!\n");
+		return -1; // BAD KNIB FILE!
+	}
+
+	if(set->flags & KNIB_SET_KEY) {
+
+		if(_decode_set(ctx, set, read_buffer, ref, shuffle_buffer, &data) != 0)
+			return -1;
+
+		// plain data is still in the read buffer, or the mapping.
+		if(data != ref)
+			for(i=0; i<4; i++)
+				memcpy(ref + offset[i], ((char *)data) + offset[i], size[i]);
+
+		_all_dirty(set, dirty_offset, dirty_size);
+		return 0;
+	}
+
+	if(ctx->flags & KNIB_DATA_DICT) {
+
+		void * dst[4];
+		char * src;
+
+		for(i=0; i<4; i++)
+			dst[i] = ((char *)scratch) + offset[i];
+
+		if(_read_set_data(ctx, set, read_buffer, &src) != 0 || _decode_planes(ctx, set, src, dst, ref, NULL) != 0)
+			return -1;
+
+		for(i=0; i<4; i++)
+			_update_plane(ref + offset[i], ((const char *)scratch) + offset[i], size[i], &dirty_offset[i], &dirty_size[i]);
+
+		return 0;
+	}
+
+	if(_decode_set(ctx, set, read_buffer, scratch, shuffle_buffer, &data) != 0)
+		return -1;
+
+	for(i=0; i<4; i++)
+		_xor_plane(ref + offset[i], ((const char *)data) + offset[i], size[i], &dirty_offset[i], &dirty_size[i]);
+
+	return 0;
+}
+
+// KNIB_DATA_CHAINED: finds the set to start rebuilding 'set' from.
+// That's the last key set, or the set after 'ref_set' if that is closer.
+static int _find_chain_start(struct knib_context * ctx, int set, int ref_set, int * start, int64_t * start_offset) {
+
+	struct knib_set_header header;
+	int64_t offset;
+	int i;
+
+	if(ctx->set_index && set < ctx->sets) {
+
+		// walk back from 'set'.
+		for(i=set; i>=0; i--) {
+
+			*start = i;
+			*start_offset = ctx->set_index[i].set_offset;
+
+			if(ref_set >= 0 && i-1 == ref_set)
+				return 0;
+
+			if(_read_set_header(ctx, *start_offset, &header) != 0)
+				return -1;
+
+			if(header.flags & KNIB_SET_KEY)
+				return 0;
+		}
+	}
+	else {
+
+		// No index, walk forward from the first set.
+		*start = -1;
+		offset = ctx->first_set;
+		for(i=0; i<=set; i++) {
+
+			if(_read_set_header(ctx, offset, &header) != 0)
+				return -1;
+
+			if((header.flags & KNIB_SET_KEY) || (ref_set >= 0 && i-1 == ref_set)) {
+				*start = i;
+				*start_offset = offset;
+			}
+			offset = header.next_set_offset;
+		}
+
+		if(*start >= 0)
+			return 0;
+	}
+
+	printf("no key set before set %d\n", set);
+	return -1;
+}
+
+// KNIB_DATA_CHAINED: rebuilds 'set', at 'set_offset', in 'ref' which holds set '*ref_set'. ( -1 for none )
+// The dirty ranges are only narrower than the planes if 'ref' held the set before.
+static int _rebuild_set(struct knib_context * ctx, int set, int64_t set_offset, struct knib_set_header * header,
+		void * read_buffer, void * scratch, void * shuffle_buffer, char * ref, int * ref_set, int dirty_offset[4], int dirty_size[4])
+{
+	int64_t offset = set_offset;
+	int start = set;
+	int i;
+
+	if(*ref_set == set) {
+		memset(dirty_size, 0, 4 * sizeof(int));
+		return _read_set_header(ctx, set_offset, header);
+	}
+
+	if(*ref_set < 0 || *ref_set != set - 1)
+		if(_find_chain_start(ctx, set, *ref_set, &start, &offset) != 0)
+			return -1;
+
+	for(i=start; i<=set; i++) {
+
+		// 'ref' is undefined until the set is applied.
+		*ref_set = -1;
+
+		if(_read_set_header(ctx, offset, header) != 0 ||
+			_apply_set(ctx, header, read_buffer, scratch, shuffle_buffer, ref, dirty_offset, dirty_size) != 0)
+				return -1;
+
+		*ref_set = i;
+		offset = header->next_set_offset;
+	}
+
+	if(start != set)
+		_all_dirty(header, dirty_offset, dirty_size);
+
+	return 0;
+}
+
+static int _read_header(struct knib_context * ctx, struct knib_header * file_header) {
+
+	struct knib_header_v0 v0;
+
+	// the version is at the same offset in all versions.
+	if((_seek(ctx, 0) != 0) ||
+		((*ctx->read_func)(&v0, sizeof v0, 1, ctx->stream) != 1)) {
+			printf("cant read header\n");
+			return -1;
+	}
+
+	if(v0.version < 0 || v0.version > 3) {
+		printf("unsupported knib version %d\n", v0.version);
+		return -1;
+	}
+
+	if(v0.version >= 2) {
+		if((_seek(ctx, 0) != 0) ||
+			((*ctx->read_func)(file_header, sizeof *file_header, 1, ctx->stream) != 1)) {
+				printf("cant read header\n");
+				return -1;
+		}
+		return 0;
+	}
+
+	memcpy(file_header->magick, v0.magick, sizeof v0.magick);
+	file_header->version                  = v0.version;
+	file_header->flags                    = v0.flags;
+	file_header->orig_width               = v0.orig_width;
+	file_header->orig_height              = v0.orig_height;
+	file_header->frame_width              = v0.frame_width;
+	file_header->frame_height             = v0.frame_height;
+	file_header->frames                   = v0.frames;
+	file_header->framerate                = v0.framerate;
+	file_header->compressed_buffer_size   = v0.compressed_buffer_size;
+	file_header->uncompressed_buffer_size = v0.uncompressed_buffer_size;
+	file_header->first_set_offset         = v0.first_set_offset;
+	file_header->set_index_offset         = v0.set_index_offset;
+	file_header->sets                     = v0.sets;
+	return 0;
+}
+
+static int _read_set_index(struct knib_context * ctx, int64_t set_index_offset) {
+
+	int i;
+
+	if(_seek(ctx, set_index_offset) != 0)
+		return -1;
+
+	if(ctx->version >= 2)
+		return ((*ctx->read_func)(ctx->set_index, sizeof(struct knib_set_index_entry), ctx->sets, ctx->stream) == (size_t)ctx->sets) ? 0 : -1;
+
+	for(i=0; i<ctx->sets; i++) {
+
+		struct knib_set_index_entry_v0 v0;
+
+		if((*ctx->read_func)(&v0, sizeof v0, 1, ctx->stream) != 1)
+			return -1;
+
+		ctx->set_index[i].set_offset = v0.set_offset;
+		ctx->set_index[i].set_size   = v0.set_size;
+	}
+	return 0;
+}
+
+static int _init(struct knib_context * ctx) {
+
+	struct knib_header file_header;
+
+	ctx->planes = KNIB_PLANES_ALL;
+	ctx->decode_threads = 1;
+
+	// READ HEADER
+	if(_read_header(ctx, &file_header) != 0)
+		return -1;
+
+	// Load header info.
+	ctx->version = file_header.version;
+	ctx->frames = file_header.frames;
+	ctx->flags = file_header.flags;
+	ctx->first_set = file_header.first_set_offset;
+	ctx->tex_width = file_header.frame_width;
+	ctx->tex_height = file_header.frame_height;
+	ctx->read_buffer_size = file_header.compressed_buffer_size;
+	ctx->decode_buffer_size = file_header.uncompressed_buffer_size;
+
+	// plain data needs no codec. ( knib_compress leaves the mask zero for it )
+	if((ctx->flags & KNIB_DATA_MASK) != 0 && (ctx->flags & KNIB_DATA_MASK) != KNIB_DATA_PLAIN &&
+		!(ctx->codec = _find_codec(ctx->flags)))
+	{
+		printf("unsupported data compression\n");
+		return -1;
+	}
+
+	// shuffled planes are always compressed, and never chunked.
+	if((ctx->flags & KNIB_DATA_SHUFFLE) && (!ctx->codec || (ctx->flags & KNIB_DATA_DICT))) {
+		printf("unsupported data flags\n");
+		return -1;
+	}
+
+	// READ SET INDEX
+	if((ctx->flags & KNIB_INDEXED) && file_header.sets > 0) {
+
+		ctx->sets = file_header.sets;
+
+		if(!(ctx->set_index = malloc(ctx->sets * sizeof(struct knib_set_index_entry)))) {
+			printf("cant allocate set index\n");
+			return -1;
+		}
+
+		if(_read_set_index(ctx, file_header.set_index_offset) != 0) {
+				printf("cant read set index\n");
+				free(ctx->set_index);
+				ctx->set_index = NULL;
+				return -1;
+		}
+	}
+
+	// READ FIRST SET
+	if(_read_set_header(ctx, ctx->first_set, &ctx->cur_set) != 0) {
+			printf("cant read first set\n");
+			free(ctx->set_index);
+			ctx->set_index = NULL;
+			return -1;
+	}
+
+	printf("Allocating %d bytes read buffer\n",ctx->read_buffer_size);
+	printf("Allocating %d bytes decode buffer\n",ctx->decode_buffer_size);
+
+	// Allocate buffers for reading and decoding. ( mapped files are read in place )
+	if(ctx->map || (ctx->read_buffer = malloc(ctx->read_buffer_size))) {
+		if(ctx->decode_buffer_size)
+			if((ctx->decode_buffer = malloc(ctx->decode_buffer_size))==NULL ||
+				((ctx->flags & KNIB_DATA_SHUFFLE) && (ctx->shuffle_buffer = malloc(ctx->decode_buffer_size))==NULL)) {
+				printf("cant allocate buffers\n");
+				free(ctx->decode_buffer);
+				free(ctx->read_buffer);
+				free(ctx->set_index);
+				return -1;
+			}
+	}
+
+	// chained sets are rebuilt in a buffer of their own, as the decode buffer holds each set as it's decoded.
+	if(ctx->flags & KNIB_DATA_CHAINED) {
+
+		ctx->chain_set = -1;
+
+		if(!ctx->decode_buffer_size || !(ctx->chain_buffer = malloc(ctx->decode_buffer_size)) ||
+			_rebuild_set(ctx, 0, ctx->first_set, &ctx->cur_set, ctx->read_buffer, ctx->decode_buffer, ctx->shuffle_buffer,
+				ctx->chain_buffer, &ctx->chain_set, ctx->dirty_offset, ctx->dirty_size) != 0)
+		{
+			printf("cant load first chained set\n");
+			free(ctx->chain_buffer);
+			ctx->chain_buffer = NULL;
+			free(ctx->shuffle_buffer);
+			free(ctx->decode_buffer);
+			free(ctx->read_buffer);
+			free(ctx->set_index);
+			return -1;
+		}
+
+		ctx->cur_data = ctx->chain_buffer;
+	}
+	else if(_decode_set(ctx, &ctx->cur_set, ctx->read_buffer, ctx->decode_buffer, ctx->shuffle_buffer, &ctx->cur_data)!=0) {
+		free(ctx->shuffle_buffer);
+		free(ctx->decode_buffer);
+		free(ctx->read_buffer);
+		free(ctx->set_index);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int _frames_per_set(struct knib_context * ctx) {
+
+	// Packed formats are updated every frame, Planar formats are updated every 3rd.
+	return ((ctx->flags & KNIB_CHANNELS_MASK) == KNIB_CHANNELS_PACKED) ? 1 : 3;
+}
+
+// loads a set into an async slot. 'prev' is the slot loaded before it, or NULL if that may be in use.
+// The encoder stores a repeated set ( a static hold ) as a header pointing at the earlier sets data,
+//  which is copied from 'prev' rather than read and decoded again.
+static int _load_slot(struct knib_context * ctx, int64_t set_offset, struct knib_slot * slot, const struct knib_slot * prev) {
+
+	if(_read_set_header(ctx, set_offset, &slot->set) != 0)
+		return -1;
+
+	if(!prev || prev->set.data_offset != slot->set.data_offset || prev->set.data_size != slot->set.data_size)
+		return _decode_set(ctx, &slot->set, slot->read_buffer, slot->decode_buffer, slot->shuffle_buffer, &slot->data);
+
+	if(prev->data == prev->decode_buffer) {
+		memcpy(slot->decode_buffer, prev->data, slot->set.data_uncompressed_size);
+		slot->data = slot->decode_buffer;
+	}
+	else if(prev->data == prev->read_buffer) {
+		memcpy(slot->read_buffer, prev->data, slot->set.data_size);
+		slot->data = slot->read_buffer;
+	}
+	else
+		slot->data = prev->data; // in the mapping.
+
+	return 0;
+}
+
+// KNIB_DATA_CHAINED: sets build on the set before, so are rebuilt as soon as they are loaded.
+static int _load_chained_set(struct knib_context * ctx, int set, int64_t set_offset) {
+
+	ctx->cur_data = NULL;
+
+	if(_rebuild_set(ctx, set, set_offset, &ctx->cur_set, ctx->read_buffer, ctx->decode_buffer, ctx->shuffle_buffer,
+			ctx->chain_buffer, &ctx->chain_set, ctx->dirty_offset, ctx->dirty_size) != 0)
+		return -1;
+
+	ctx->cur_data = ctx->chain_buffer;
+	return 0;
+}
+
+// returns the current sets plane data, decoding it if it hasn't been already.
+static void * _cur_data(struct knib_context * ctx) {
+
+	// a chained set that failed to load can't be decoded on its own.
+	if(!ctx->cur_data && !(ctx->flags & KNIB_DATA_CHAINED))
+		if(_decode_set(ctx, &ctx->cur_set, ctx->read_buffer, ctx->decode_buffer, ctx->shuffle_buffer, &ctx->cur_data) != 0)
+			return NULL;
+
+	return ctx->cur_data;
+}
+
+static int _find_set(struct knib_context * ctx, int set, int64_t * set_offset) {
+
+	if(ctx->set_index && set < ctx->sets) {
+		*set_offset = ctx->set_index[set].set_offset;
+	}
+	else {
+		// No index, walk the set headers from the first set.
+		struct knib_set_header header;
+		int i;
+
+		*set_offset = ctx->first_set;
+		for(i=0; i<set; i++) {
+			if(_read_set_header(ctx, *set_offset, &header) != 0)
+				return -1;
+			*set_offset = header.next_set_offset;
+		}
+	}
+	return 0;
+}
+
+static void * _async_thread(void * arg) {
+
+	struct knib_context * ctx = (struct knib_context *)arg;
+	struct knib_async * async = ctx->async;
+	const int frames_per_set = _frames_per_set(ctx);
+
+	pthread_mutex_lock(&async->mutex);
+
+	for(;;) {
+
+		int generation, set, e;
+		int64_t set_offset;
+		struct knib_slot * slot;
+		const struct knib_slot * prev;
+
+		while(!async->quit && (async->stalled || async->filled == KNIB_ASYNC_SLOTS-1))
+			pthread_cond_wait(&async->cond, &async->mutex);
+
+		if(async->quit)
+			break;
+
+		generation = async->generation;
+		set = async->next_set;
+		set_offset = async->next_set_offset;
+		slot = &async->slots[(async->cur + 1 + async->filled) % KNIB_ASYNC_SLOTS];
+
+		// the current slot may be decoded again by the consumer, ( see 'knib_set_planes' ) filled slots aren't.
+		prev = async->filled ? &async->slots[(async->cur + async->filled) % KNIB_ASYNC_SLOTS] : NULL;
+
+		// The consumer never touches a slot after 'cur' until it is 'filled'.
+		async->loading = 1;
+		pthread_mutex_unlock(&async->mutex);
+
+		e = 0;
+		if(set_offset < 0)
+			e = _find_set(ctx, set, &set_offset);
+		if(e == 0 && (ctx->flags & KNIB_DATA_CHAINED)) {
+			// the worker rebuilds sets in a buffer of its own, each slot gets a copy.
+			e = _rebuild_set(ctx, set, set_offset, &slot->set, slot->read_buffer, slot->decode_buffer, slot->shuffle_buffer,
+				async->chain_buffer, &async->chain_set, slot->dirty_offset, slot->dirty_size);
+			if(e == 0) {
+				memcpy(slot->decode_buffer, async->chain_buffer, slot->set.data_uncompressed_size);
+				slot->data = slot->decode_buffer;
+			}
+		}
+		else if(e == 0)
+			e = _load_slot(ctx, set_offset, slot, prev);
+
+		pthread_mutex_lock(&async->mutex);
+
+		async->loading = 0;
+		pthread_cond_broadcast(&async->cond);
+
+		if(generation != async->generation)
+			continue; // seeked, or the settings changed, while we were loading. discard.
+
+		slot->set_number = set;
+		slot->error = e;
+		async->filled++;
+
+		if(e)
+			async->stalled = 1;
+		else if((set + 1) * frames_per_set >= ctx->frames) {
+			async->next_set = 0; // loop
+			async->next_set_offset = ctx->first_set;
+		}
+		else {
+			async->next_set = set + 1;
+			async->next_set_offset = slot->set.next_set_offset;
+		}
+
+		pthread_cond_broadcast(&async->cond);
+	}
+
+	pthread_mutex_unlock(&async->mutex);
+
+	return NULL;
+}
+
+// wait for the worker to deliver the next set, and swap it in.
+static int _async_next_set(struct knib_context * ctx, int set) {
+
+	struct knib_async * async = ctx->async;
+	struct knib_slot * slot;
+	int e = 0;
+
+	pthread_mutex_lock(&async->mutex);
+
+	while(async->filled == 0)
+		pthread_cond_wait(&async->cond, &async->mutex);
+
+	slot = &async->slots[(async->cur + 1) % KNIB_ASYNC_SLOTS];
+
+	if(slot->error || slot->set_number != set) {
+		printf("knib async: expected set %d, got set %d\n", set, slot->set_number);
+		e = -1;
+	}
+	else {
+		async->cur = (async->cur + 1) % KNIB_ASYNC_SLOTS;
+		async->filled--;
+
+		ctx->cur_set       = slot->set;
+		ctx->read_buffer   = slot->read_buffer;
+		ctx->decode_buffer = slot->decode_buffer;
+		ctx->shuffle_buffer = slot->shuffle_buffer;
+		ctx->cur_data      = slot->data;
 
-#include "knib_read.h"
+		memcpy(ctx->dirty_offset, slot->dirty_offset, sizeof ctx->dirty_offset);
+		memcpy(ctx->dirty_size, slot->dirty_size, sizeof ctx->dirty_size);
 
-struct knib_set_header {
+		pthread_cond_broadcast(&async->cond);
+	}
 
-	int data_offset; // file offset of this sets data.
-	int data_size; // file size of this sets data.
-	int data_uncompressed_size; // size of this sets data once uncompressed.
+	pthread_mutex_unlock(&async->mutex);
 
-	int y_data_buffer_offset; // 'Y' data offset in the uncompressed buffer.
-	int y_data_buffer_size; // 'Y' data size in the uncompressed buffer.
-	int cb_data_buffer_offset; // 'Cb' data offset in the uncompressed buffer.
-	int cb_data_buffer_size;// 'Cb' data size in the uncompressed buffer.
-	int cr_data_buffer_offset;// 'Cr' data offset in the uncompressed buffer.
-	int cr_data_buffer_size;// 'Cr' data size in the uncompressed buffer.
-	int a_data_buffer_offset;// 'A' data offset in the uncompressed buffer.
-	int a_data_buffer_size;// 'A' data size in the uncompressed buffer.
+	return e;
+}
 
-	int next_set_offset; // file offset of the next
-};
+static int _async_seek_set(struct knib_context * ctx, int set) {
 
-struct knib_context {
+	struct knib_async * async = ctx->async;
 
-	int is_custom_io;
+	pthread_mutex_lock(&async->mutex);
 
-	knib_read read_func;
-	knib_seek seek_func;
-	void * stream;
+	async->generation++;
+	async->filled = 0;
+	async->stalled = 0;
+	async->next_set = set;
+	async->next_set_offset = -1;
 
-	int    flags;
-	int    first_set;
-	int    tex_width;
-	int    tex_height;
-	void * read_buffer;
-	int    read_buffer_size;
-	void * decode_buffer;
-	int    decode_buffer_size;
-	int    cur_frame;
-	int    frames;
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
 
-	struct knib_set_header cur_set;
-};
+	return _async_next_set(ctx, set);
+}
 
-static int _is_a_knib_stream(struct knib_context * ctx) {
+static void _async_free(struct knib_context * ctx) {
 
-	struct knib_header file_header;
-	if((*ctx->read_func)(&file_header, sizeof file_header, 1, ctx->stream) ==1) {
+	struct knib_async * async = ctx->async;
+	int i;
 
-		if(strcmp(file_header.magick,"knib")==0)
-			return 0;
-		else
-			printf("bad magick\n\n");
+	for(i=0; i<KNIB_ASYNC_SLOTS; i++) {
+		free(async->slots[i].read_buffer);
+		free(async->slots[i].decode_buffer);
+		free(async->slots[i].shuffle_buffer);
 	}
-	printf("not a knib stream\n");
-	return -1;
+
+	free(async->chain_buffer);
+
+	// context buffers belong to one of the slots.
+	ctx->read_buffer = NULL;
+	ctx->decode_buffer = NULL;
+	ctx->shuffle_buffer = NULL;
+
+	free(async);
+	ctx->async = NULL;
 }
 
-static int _decode_set(struct knib_context * ctx) {
+static int _async_start(struct knib_context * ctx) {
 
-	if((*ctx->seek_func)(ctx->stream, ctx->cur_set.data_offset, SEEK_SET) != 0) {
-		printf("cant seek to cur set data\n");
+	struct knib_async * async;
+	int i;
+
+	if(!(async = calloc(1, sizeof(struct knib_async))))
 		return -1;
-	}
 
-	if(ctx->cur_set.data_size > ctx->read_buffer_size) {
-		printf("buffer not big enough!\n");
-		return -1; // BAD KNIB FILE!
+	ctx->async = async;
+
+	// the worker takes over the chain buffer, and slot 0 gets a copy of the set in it.
+	if(ctx->flags & KNIB_DATA_CHAINED) {
+		async->chain_buffer = ctx->chain_buffer;
+		async->chain_set = ctx->chain_set;
+		ctx->chain_buffer = NULL;
+		memcpy(ctx->decode_buffer, async->chain_buffer, ctx->cur_set.data_uncompressed_size);
+		ctx->cur_data = ctx->decode_buffer;
 	}
 
-	if((*ctx->read_func)( ctx->read_buffer, ctx->cur_set.data_size, 1, ctx->stream ) != 1) {
-		printf("set data truncated\n");
-		printf("read %d bytes from offset %d\n", ctx->cur_set.data_size, ctx->cur_set.data_offset);
-		return -1; // TRUNCATED KNIB FILE!?
+	// slot 0 takes ownership of the set decoded by '_init'.
+	async->slots[0].set = ctx->cur_set;
+	async->slots[0].read_buffer = ctx->read_buffer;
+	async->slots[0].decode_buffer = ctx->decode_buffer;
+	async->slots[0].shuffle_buffer = ctx->shuffle_buffer;
+	async->slots[0].data = ctx->cur_data;
+
+	for(i=1; i<KNIB_ASYNC_SLOTS; i++) {
+		if(!(async->slots[i].read_buffer = malloc(ctx->read_buffer_size)) ||
+			(ctx->decode_buffer_size && !(async->slots[i].decode_buffer = malloc(ctx->decode_buffer_size))) ||
+			(ctx->shuffle_buffer && !(async->slots[i].shuffle_buffer = malloc(ctx->decode_buffer_size)))) {
+				printf("cant allocate async buffers\n");
+				_async_free(ctx);
+				return -1;
+		}
 	}
 
-	if((ctx->flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4) {
+	if(_frames_per_set(ctx) >= ctx->frames) {
+		async->next_set = 0;
+		async->next_set_offset = ctx->first_set;
+	}
+	else {
+		async->next_set = 1;
+		async->next_set_offset = ctx->cur_set.next_set_offset;
+	}
 
-//		printf("read size = %d\n", ctx->cur_set.data_size);
-//		printf("LZ4_uncompress( %p, %p, %d)\n",ctx->read_buffer, ctx->decode_buffer, ctx->cur_set.data_uncompressed_size);
+	pthread_mutex_init(&async->mutex, NULL);
+	pthread_cond_init(&async->cond, NULL);
 
-		if(LZ4_uncompress( ctx->read_buffer, ctx->decode_buffer, ctx->cur_set.data_uncompressed_size ) != ctx->cur_set.data_size) {
-			printf("LZ4 failed\n");
-			return -1; // BAD OR TRUNCATED KNIB FILE!
-		}
+	if(pthread_create(&async->thread, NULL, &_async_thread, ctx) != 0) {
+		printf("cant create async thread\n");
+		pthread_cond_destroy(&async->cond);
+		pthread_mutex_destroy(&async->mutex);
+		_async_free(ctx);
+		return -1;
 	}
 
 	return 0;
 }
 
-static int _init(struct knib_context * ctx) {
+// Waits for the worker to finish the set it is loading, and holds it off until '_async_resume'.
+// The worker reads the decode settings, so they only change in between.
+static void _async_pause(struct knib_context * ctx) {
 
-	struct knib_header file_header;
+	struct knib_async * async = ctx->async;
 
-	// READ HEADER
-	if(((*ctx->seek_func)(ctx->stream, 0, SEEK_SET) != 0) ||
-		((*ctx->read_func)(&file_header, sizeof file_header, 1, ctx->stream) != 1)) {
-			printf("cant read header\n");
-			return -1;
-	}
+	if(!async)
+		return;
 
-	// Load header info.
-	ctx->frames = file_header.frames;
-	ctx->flags = file_header.flags;
-	ctx->first_set = file_header.first_set_offset;
-	ctx->tex_width = file_header.frame_width;
-	ctx->tex_height = file_header.frame_height;
-	ctx->read_buffer_size = file_header.compressed_buffer_size;
-	ctx->decode_buffer_size = file_header.uncompressed_buffer_size;
+	pthread_mutex_lock(&async->mutex);
 
-	// READ FIRST SET
-	if(((*ctx->seek_func)(ctx->stream, ctx->first_set, SEEK_SET) != 0) ||
-		((*ctx->read_func)(&ctx->cur_set, sizeof ctx->cur_set, 1, ctx->stream) != 1)) {
-			printf("cant read first set\n");
-			return -1;
-	}
+	while(async->loading)
+		pthread_cond_wait(&async->cond, &async->mutex);
+}
 
-	printf("Allocating %d bytes read buffer\n",ctx->read_buffer_size);
-	printf("Allocating %d bytes decode buffer\n",ctx->decode_buffer_size);
+// lets the worker carry on. With 'discard', sets it loaded ahead are loaded again, after the current set.
+static void _async_resume(struct knib_context * ctx, int discard) {
 
-	// Allocate buffers for reading and decoding.
-	if((ctx->read_buffer = malloc(ctx->read_buffer_size))) {
-		if(ctx->decode_buffer_size)
-			if((ctx->decode_buffer = malloc(ctx->decode_buffer_size))==NULL) {
-				printf("cant allocate buffers\n");
-				free(ctx->read_buffer);
-				return -1;
-			}
-	}
+	struct knib_async * async = ctx->async;
+	const struct knib_slot * cur;
 
-	if(_decode_set(ctx)!=0) {
-		free(ctx->decode_buffer);
-		free(ctx->read_buffer);
-		return -1;
+	if(!async)
+		return;
+
+	if(discard) {
+
+		cur = &async->slots[async->cur];
+
+		async->generation++;
+		async->filled = 0;
+		async->stalled = 0;
+
+		if((cur->set_number + 1) * _frames_per_set(ctx) >= ctx->frames) {
+			async->next_set = 0; // loop
+			async->next_set_offset = ctx->first_set;
+		}
+		else {
+			async->next_set = cur->set_number + 1;
+			async->next_set_offset = ctx->cur_set.next_set_offset;
+		}
 	}
 
-	return 0;
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+}
+
+static void _async_stop(struct knib_context * ctx) {
+
+	struct knib_async * async = ctx->async;
+
+	pthread_mutex_lock(&async->mutex);
+	async->quit = 1;
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+
+	pthread_join(async->thread, NULL);
+
+	pthread_cond_destroy(&async->cond);
+	pthread_mutex_destroy(&async->mutex);
+	_async_free(ctx);
 }
 
 int knib_open_file( const char * fn, knib_handle * h ) {
@@ -163,7 +1558,7 @@ int knib_open_file( const char * fn, knib_handle * h ) {
 
 		if(((*h)->stream = fopen(fn, "rb"))) {
 			(*h)->read_func = (knib_read)&fread;
-			(*h)->seek_func = (knib_seek)&fseek;
+			(*h)->seek64_func = &_file_seek;
 
 			if(_is_a_knib_stream(*h)==0 && _init(*h)==0)
 				return 0;
@@ -176,6 +1571,91 @@ int knib_open_file( const char * fn, knib_handle * h ) {
 	return -1;
 }
 
+int knib_open_file_async( const char * fn, knib_handle * h ) {
+
+	if(knib_open_file(fn, h) == 0) {
+
+		if(_async_start(*h) == 0)
+			return 0;
+
+		knib_close(*h);
+		*h = NULL;
+	}
+	return -1;
+}
+
+static struct knib_mmap_stream * _mmap_open(const char * fn) {
+
+	struct knib_mmap_stream * map;
+	struct stat st;
+	int fd;
+
+	if((fd = open(fn, O_RDONLY)) < 0)
+		return NULL;
+
+	if(fstat(fd, &st) != 0 || st.st_size <= 0 || !(map = calloc(1, sizeof *map))) {
+		close(fd);
+		return NULL;
+	}
+
+	map->size = st.st_size;
+	map->base = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+
+	// the mapping holds its own reference to the file.
+	close(fd);
+
+	if(map->base == MAP_FAILED) {
+		free(map);
+		return NULL;
+	}
+	return map;
+}
+
+static void _mmap_close(struct knib_mmap_stream * map) {
+
+	munmap(map->base, map->size);
+	free(map);
+}
+
+int knib_open_mmap( const char * fn, knib_handle * h ) {
+
+	if((*h = calloc(1, sizeof(struct knib_context) ))) {
+
+		if(((*h)->map = _mmap_open(fn))) {
+			(*h)->stream = (*h)->map;
+			(*h)->read_func = &_mmap_read;
+			(*h)->seek64_func = &_mmap_seek;
+
+			if(_is_a_knib_stream(*h)==0 && _init(*h)==0)
+				return 0;
+
+			_mmap_close((*h)->map);
+		}
+
+		free(*h);
+		*h = NULL;
+	}
+	return -1;
+}
+
+int knib_open_custom64( knib_read read_func, knib_seek64 seek_func, void * stream, knib_handle * h ) {
+
+	if((*h = calloc(1, sizeof(struct knib_context) ))) {
+
+		(*h)->read_func   = read_func;
+		(*h)->seek64_func = seek_func;
+		(*h)->stream      = stream;
+		(*h)->is_custom_io = 1;
+
+		if(_is_a_knib_stream(*h)==0 && _init(*h)==0)
+			return 0;
+
+		free(*h);
+		*h = NULL;
+	}
+	return -1;
+}
+
 int knib_open_custom( knib_read read_func, knib_seek seek_func, void * stream, knib_handle * h ) {
 
 	if((*h = calloc(1, sizeof(struct knib_context) ))) {
@@ -196,9 +1676,18 @@ int knib_open_custom( knib_read read_func, knib_seek seek_func, void * stream, k
 
 int knib_close(struct knib_context * ctx) {
 
+	if(ctx->async)
+		_async_stop(ctx);
+	if(ctx->pool)
+		_pool_stop(ctx->pool);
+	free( ctx->chain_buffer );
+	free( ctx->shuffle_buffer );
 	free( ctx->decode_buffer );
 	free( ctx->read_buffer );
-	if(ctx->is_custom_io==0)
+	free( ctx->set_index );
+	if(ctx->map)
+		_mmap_close(ctx->map);
+	else if(ctx->is_custom_io==0)
 		fclose((FILE*)(ctx->stream));
 	free(ctx);
 	return 0;
@@ -206,7 +1695,8 @@ int knib_close(struct knib_context * ctx) {
 
 int knib_next_frame(struct knib_context * ctx) {
 
-	int next_set_offset = ctx->cur_set.next_set_offset;
+	int64_t next_set_offset = ctx->cur_set.next_set_offset;
+	const int frames_per_set = _frames_per_set(ctx);
 	ctx->cur_frame++;
 
 	if(ctx->cur_frame == ctx->frames) {
@@ -214,29 +1704,149 @@ int knib_next_frame(struct knib_context * ctx) {
 		next_set_offset = ctx->first_set;
 	}
 
-	// Packed formats are updated every frame, Planar formats are updated every 3rd.
-	if(((ctx->flags & KNIB_CHANNELS_MASK) == KNIB_CHANNELS_PACKED) || ((ctx->cur_frame % 3) == 0)) {
+	// frames of the same set share its textures.
+	ctx->unchanged = 1;
 
+	if((ctx->cur_frame % frames_per_set) == 0) {
+
+		const struct knib_set_header last_set = ctx->cur_set;
+
+		const int chained = !!(ctx->flags & KNIB_DATA_CHAINED);
 		int e;
 
-		if((*ctx->seek_func)(ctx->stream, next_set_offset, SEEK_SET) != 0) {
-			printf("knib_next_frame: couldn't seek\n");
-			return -1;
-		}
+		if(ctx->async)
+			e = _async_next_set(ctx, ctx->cur_frame / frames_per_set);
+		else if(chained)
+			e = _load_chained_set(ctx, ctx->cur_frame / frames_per_set, next_set_offset);
+		else
+			e = _read_set_header(ctx, next_set_offset, &ctx->cur_set);
 
-		if(((*ctx->read_func)(&ctx->cur_set, sizeof ctx->cur_set, 1, ctx->stream) != 1)) {
-			printf("knib_next_frame: couldn't read frame %d set @ %d\n", ctx->cur_frame, next_set_offset);
-			return -1;
-		}
-		if((e = _decode_set(ctx)) == 0)
-			return ctx->cur_frame;
+		if(chained)
+			// chained sets know which blocks they changed.
+			ctx->unchanged = e == 0 &&
+				!ctx->dirty_size[0] && !ctx->dirty_size[1] && !ctx->dirty_size[2] && !ctx->dirty_size[3];
 		else
+			// The encoder stores a repeated set ( a static hold ) as a header pointing at the earlier sets data.
+			ctx->unchanged = e == 0 &&
+				ctx->cur_set.data_offset == last_set.data_offset &&
+				ctx->cur_set.data_size == last_set.data_size;
+
+		// data is decoded on demand. ( see '_cur_data' and 'knib_decode_set_into' )
+		if(!ctx->async && !chained && !ctx->unchanged)
+			ctx->cur_data = NULL;
+
+		if(e == 0)
+			return ctx->cur_frame;
+		else {
+			printf("knib_next_frame: couldn't load frame %d\n", ctx->cur_frame);
 			return e;
+		}
 	}
 
 	return ctx->cur_frame;
 }
 
+int knib_seek_frame(struct knib_context * ctx, int frame) {
+
+	const int frames_per_set = _frames_per_set(ctx);
+	const int set = frame / frames_per_set;
+	int64_t set_offset;
+	int e;
+
+	if(frame < 0 || frame >= ctx->frames) {
+		printf("knib_seek_frame: frame %d out of range\n", frame);
+		return -1;
+	}
+
+	// Already loaded.
+	if(set == ctx->cur_frame / frames_per_set) {
+		ctx->cur_frame = frame;
+		ctx->unchanged = 1;
+		return frame;
+	}
+
+	ctx->unchanged = 0;
+
+	if(ctx->async)
+		e = _async_seek_set(ctx, set);
+	else if((e = _find_set(ctx, set, &set_offset)) == 0) {
+		if(ctx->flags & KNIB_DATA_CHAINED)
+			e = _load_chained_set(ctx, set, set_offset);
+		else {
+			ctx->cur_data = NULL;
+			e = _read_set_header(ctx, set_offset, &ctx->cur_set);
+		}
+	}
+
+	if(e != 0) {
+		printf("knib_seek_frame: couldn't load frame %d\n", frame);
+		return -1;
+	}
+
+	// there's no telling what the application last uploaded.
+	_all_dirty(&ctx->cur_set, ctx->dirty_offset, ctx->dirty_size);
+
+	ctx->cur_frame = frame;
+	return frame;
+}
+
+int knib_textures_unchanged(struct knib_context * ctx) {
+
+	return ctx->unchanged;
+}
+
+// bytes in a row of 4x4 blocks of a plane. ( DXT1 and ETC1 blocks are 8 bytes )
+static int _block_row_size(struct knib_context * ctx, int plane) {
+
+	int w;
+
+	if((ctx->flags & KNIB_CHANNELS_MASK) == KNIB_CHANNELS_PACKED)
+		w = (ctx->tex_width + 3) & ~3;
+	else {
+		w = (ctx->tex_width + 7) & ~7;
+		if(plane == 1 || plane == 2)
+			w /= 2; // Cb and Cr are half width.
+	}
+
+	return (w / 4) * 8;
+}
+
+int knib_get_dirty_rows(struct knib_context * ctx, int plane, int * first_row, int * rows) {
+
+	const int size[4] = {
+		ctx->cur_set.y_data_buffer_size, ctx->cur_set.cb_data_buffer_size,
+		ctx->cur_set.cr_data_buffer_size, ctx->cur_set.a_data_buffer_size };
+	int i, row_size;
+
+	switch(plane) {
+	case KNIB_PLANE_Y:  i = 0; break;
+	case KNIB_PLANE_CB: i = 1; break;
+	case KNIB_PLANE_CR: i = 2; break;
+	case KNIB_PLANE_A:  i = 3; break;
+	default:
+		return -1;
+	}
+
+	row_size = _block_row_size(ctx, i);
+
+	*first_row = 0;
+	*rows = 0;
+
+	if(ctx->unchanged || !size[i] || !row_size)
+		return 0;
+
+	if(!(ctx->flags & KNIB_DATA_CHAINED)) {
+		*rows = size[i] / row_size;
+		return 0;
+	}
+
+	if(ctx->dirty_size[i]) {
+		*first_row = ctx->dirty_offset[i] / row_size;
+		*rows = (ctx->dirty_offset[i] + ctx->dirty_size[i] + row_size - 1) / row_size - *first_row;
+	}
+	return 0;
+}
+
 int knib_current_frame(struct knib_context * ctx) {
 
 	return ctx->cur_frame;
@@ -270,11 +1880,10 @@ int knib_get_frame_data(struct knib_context * ctx,
 		void ** CrData, int * CrSize,
 		void ** AData,  int * ASize)
 {
-	void * buff;
-	if((ctx->flags & KNIB_DATA_MASK) == KNIB_DATA_LZ4)
-		buff = ctx->decode_buffer;
-	else
-		buff = ctx->read_buffer;
+	void * buff = _cur_data(ctx);
+
+	if(!buff)
+		return -1;
 
 	*YData  = (((char *)buff) + ctx->cur_set.y_data_buffer_offset);
 	*CbData = (((char *)buff) + ctx->cur_set.cb_data_buffer_offset);
@@ -288,3 +1897,116 @@ int knib_get_frame_data(struct knib_context * ctx,
 	return 0;
 }
 
+
+int knib_get_frame_sizes(struct knib_context * ctx,
+		int * YSize, int * CbSize, int * CrSize, int * ASize)
+{
+	*YSize  = ctx->cur_set.y_data_buffer_size;
+	*CbSize = ctx->cur_set.cb_data_buffer_size;
+	*CrSize = ctx->cur_set.cr_data_buffer_size;
+	*ASize  = ctx->cur_set.a_data_buffer_size;
+	return 0;
+}
+
+int knib_decode_set_into(struct knib_context * ctx,
+		void * YDst, void * CbDst, void * CrDst, void * ADst)
+{
+	void * dst[4] = { YDst, CbDst, CrDst, ADst };
+	const int offset[4] = {
+		ctx->cur_set.y_data_buffer_offset,
+		ctx->cur_set.cb_data_buffer_offset,
+		ctx->cur_set.cr_data_buffer_offset,
+		ctx->cur_set.a_data_buffer_offset };
+	const int size[4] = {
+		ctx->cur_set.y_data_buffer_size,
+		ctx->cur_set.cb_data_buffer_size,
+		ctx->cur_set.cr_data_buffer_size,
+		ctx->cur_set.a_data_buffer_size };
+	// chained sets are only whole once rebuilt.
+	const int undecoded = !ctx->cur_data && !(ctx->flags & KNIB_DATA_CHAINED);
+	const struct knib_codec * codec;
+	void * buff;
+	int i;
+
+	if(_set_codec(ctx, &ctx->cur_set, &codec) != 0)
+		return -1;
+
+	if(undecoded && !ctx->map && !codec) {
+
+		// Plain data is read straight into the callers buffers.
+		for(i=0; i<4; i++) {
+			if(!dst[i] || !size[i])
+				continue;
+			if((_seek(ctx, ctx->cur_set.data_offset + offset[i]) != 0) ||
+				((*ctx->read_func)(dst[i], size[i], 1, ctx->stream) != 1)) {
+					printf("knib_decode_set_into: set data truncated\n");
+					return -1;
+			}
+		}
+		return 0;
+	}
+
+	if(undecoded && ctx->version >= 1 && codec) {
+
+		// Each plane is its own block, decode straight into the callers buffers.
+		char * src;
+
+		if(_read_set_data(ctx, &ctx->cur_set, ctx->read_buffer, &src) != 0)
+			return -1;
+
+		return _decode_planes(ctx, &ctx->cur_set, src, dst, NULL, ctx->shuffle_buffer);
+	}
+
+	// Version 0 sets are compressed as a single block, and chained sets are rebuilt, so decode, then copy out.
+	if(!(buff = _cur_data(ctx)))
+		return -1;
+
+	for(i=0; i<4; i++)
+		if(dst[i] && size[i])
+			memcpy(dst[i], ((char *)buff) + offset[i], size[i]);
+
+	return 0;
+}
+
+int knib_set_planes(struct knib_context * ctx, int planes) {
+
+	// chained sets always decode every plane.
+	const int more = !(ctx->flags & KNIB_DATA_CHAINED) && (planes & KNIB_PLANES_ALL & ~ctx->planes);
+
+	_async_pause(ctx);
+
+	ctx->planes = planes & KNIB_PLANES_ALL;
+
+	// planes that were skipped hold undefined data, so decode them again.
+	if(more)
+		ctx->cur_data = NULL;
+
+	// sets loaded ahead were decoded with the old planes.
+	_async_resume(ctx, more);
+	return 0;
+}
+
+int knib_set_decode_threads(struct knib_context * ctx, int threads) {
+
+	int e = 0;
+
+	threads = (threads < 1) ? 1 : (threads > KNIB_MAX_DECODE_THREADS) ? KNIB_MAX_DECODE_THREADS : threads;
+
+	if(threads == ctx->decode_threads)
+		return 0;
+
+	_async_pause(ctx);
+
+	if(ctx->pool)
+		_pool_stop(ctx->pool);
+	ctx->pool = NULL;
+
+	if(threads > 1 && !(ctx->pool = _pool_start(threads - 1))) {
+		threads = 1;
+		e = -1;
+	}
+	ctx->decode_threads = threads;
+
+	_async_resume(ctx, 0);
+	return e;
+}
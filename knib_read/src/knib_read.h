@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,12 +17,25 @@ enum knib_header_flags {
         KNIB_CHANNELS_PACKED = (2<<1), // ETC1 or DXT1 compressed RGB(A)
         KNIB_CHANNELS_MASK   = (3<<1), // frames format mask.
 
+        // Set IF the file has a set index. ( allows O(1) seeking )
+        KNIB_INDEXED    = (1<<3),
+
 
         // File compression flags. Must have exactly ONE of the following set.
         KNIB_DATA_PLAIN = (1<<22), // texture data is NOT compressed.
         KNIB_DATA_LZ4   = (2<<22), // texture data is LZ4 compressed.
+        KNIB_DATA_ZSTD  = (3<<22), // texture data is zstd compressed. ( version 3+, readers built with zstd only )
         KNIB_DATA_MASK  = (3<<22), // data mask
 
+        // Set IF sets, other than key sets, hold their planes XORed with the set before. ( version 3+ )
+        KNIB_DATA_DELTA = (1<<24),
+
+        // Set IF sets, other than key sets, are LZ4 compressed with the set before as a dictionary. ( version 3+ )
+        KNIB_DATA_DICT  = (1<<25),
+
+        // Set IF compressed planes hold the first 4 bytes of every texture block, then the last 4. ( version 3+ )
+        KNIB_DATA_SHUFFLE = (1<<26),
+
         // Texture format flags. Must have exactly ONE of the following set.
         KNIB_TEX_GREY   = (1<<27), // texture data is in GreyScale format.
         KNIB_TEX_ETC1   = (2<<27), // texture data is in ETC1 format
@@ -29,29 +43,99 @@ enum knib_header_flags {
         KNIB_TEX_MASK   = (3<<27), // texture data mask.
 };
 
+// Set flags. ( version 3+ )
+enum knib_set_flags {
+
+        // The set doesn't depend on the set before it. ( see KNIB_DATA_DELTA and KNIB_DATA_DICT )
+        KNIB_SET_KEY    = (1<<0),
+
+        // If any are set, the sets data is stored this way instead of as the files KNIB_DATA_MASK says.
+        // e.g. KNIB_DATA_PLAIN for a set that didn't compress, or KNIB_DATA_LZ4 for one zstd didn't pay for.
+        KNIB_SET_DATA_MASK = KNIB_DATA_MASK,
+};
+
+// KNIB_DATA_DICT planes are compressed in chunks of this size, each with the same chunk of the set before as its dictionary.
+// ( LZ4 matches can't reach back further than 64KB )
+enum { KNIB_DICT_CHUNK_SIZE = (32*1024) };
+
+// Planes of a set. ( Packed formats store RGB in 'Y' )
+enum knib_planes {
+
+        KNIB_PLANE_Y    = (1<<0),
+        KNIB_PLANE_CB   = (1<<1),
+        KNIB_PLANE_CR   = (1<<2),
+        KNIB_PLANE_A    = (1<<3),
+        KNIB_PLANES_ALL = (15<<0),
+};
+
 typedef size_t (*knib_read)(void *ptr, size_t size, size_t nmemb, void *stream);
 typedef int (*knib_seek)(void *stream, long offset, int whence);
+typedef int (*knib_seek64)(void *stream, int64_t offset, int whence);
 
 typedef struct knib_context * knib_handle;
 
 int knib_open_custom( knib_read read_func, knib_seek seek_func, void * stream, knib_handle * h );
 
+// As 'knib_open_custom', for streams larger than a 'long' can address.
+int knib_open_custom64( knib_read read_func, knib_seek64 seek_func, void * stream, knib_handle * h );
+
 int knib_open_file( const char * fn, knib_handle * h );
 
+// As 'knib_open_file', but sets are read and decoded ahead on a worker thread.
+int knib_open_file_async( const char * fn, knib_handle * h );
+
+// As 'knib_open_file', but the file is memory mapped.
+// KNIB_DATA_PLAIN frame data is returned as pointers into the ( read only ) mapping.
+int knib_open_mmap( const char * fn, knib_handle * h );
+
 int knib_flags(knib_handle ctx);
 
 int knib_get_dimensions(knib_handle ctx, int *w, int *h);
 
+// Returns the planes of the current set, decoding them if required.
 int knib_get_frame_data(knib_handle ctx,
 		void ** YData,  int * YSize,
 		void ** CbData, int * CbSize,
 		void ** CrData, int * CrSize,
 		void ** AData,  int * ASize);
 
+// Returns the plane sizes of the current set, without decoding it.
+int knib_get_frame_sizes(knib_handle ctx,
+		int * YSize, int * CbSize, int * CrSize, int * ASize);
+
+// Decodes the planes of the current set into caller provided buffers. ( e.g. mapped pixel unpack buffers )
+// Each buffer must hold the size reported by 'knib_get_frame_sizes'. NULL buffers are skipped.
+int knib_decode_set_into(knib_handle ctx,
+		void * YDst, void * CbDst, void * CrDst, void * ADst);
+
+// Selects which planes are decoded. ( see 'knib_planes' )
+// Only version 1+ compressed files ( LZ4 or zstd ) can skip planes, skipped planes hold undefined data.
+int knib_set_planes(knib_handle ctx, int planes);
+
+// Decode the planes of version 1+ compressed files on up to 'threads' threads. ( default 1, max 4 )
+// The extra threads are started here, and kept until 'knib_close'. Returns -1, and decodes on 1 thread, if they can't be.
+int knib_set_decode_threads(knib_handle ctx, int threads);
+
+// Advances to the next frame. The sets data is decoded on demand by
+// 'knib_get_frame_data' or 'knib_decode_set_into'. ( KNIB_DATA_DELTA and KNIB_DATA_DICT sets are decoded here )
 int knib_next_frame(knib_handle ctx);
 
+// Returns 1 if the current frame uses the same set data as the frame before it, 0 otherwise.
+// This holds for the 2nd and 3rd frames of a planar set, and for sets the encoder found repeated.
+// If so, the textures uploaded for the last frame can be kept, and the set needn't be decoded again.
+int knib_textures_unchanged(knib_handle ctx);
+
+// Returns the rows of 4x4 blocks of a plane ( see 'knib_planes' ) that changed since the frame before.
+// For sub-rectangle texture updates. Rows outside the range are as they were.
+// KNIB_DATA_DELTA and KNIB_DATA_DICT files narrow this to the blocks a set changed, otherwise it covers the whole plane.
+int knib_get_dirty_rows(knib_handle ctx, int plane, int * first_row, int * rows);
+
+int knib_seek_frame(knib_handle ctx, int frame);
+
 int knib_current_frame(knib_handle ctx);
 
+int knib_total_frames(knib_handle ctx);
+
 int knib_close(knib_handle ctx);
 
 #ifdef __cplusplus
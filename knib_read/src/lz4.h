@@ -123,6 +123,18 @@ LZ4_uncompress_unknownOutputSize() :
 */
 
 
+int LZ4_decompress_fast_usingDict (const char* source, char* dest, int originalSize, const char* dictStart, int dictSize);
+
+/*
+LZ4_decompress_fast_usingDict() :
+    As LZ4_uncompress(), for blocks compressed with a dictionary. ( see LZ4_compressHC_usingPrefix() in "lz4hc.h" )
+    dictStart : the 'dictSize' bytes the block was compressed after. They needn't be next to 'dest'.
+    return : the number of bytes read from the source buffer
+             If the source stream is malformed, the function will stop decoding and return a negative result, indicating the byte position of the faulty instruction
+    note   : Like LZ4_uncompress(), this trusts the source stream not to read beyond its end.
+*/
+
+
 #if defined (__cplusplus)
 }
 #endif
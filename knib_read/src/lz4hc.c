@@ -717,3 +717,17 @@ int LZ4_compressHC(const char* source,
 }
 
 
+int LZ4_compressHC_usingPrefix(const char* source,
+                 char* dest,
+                 int isize,
+                 int prefixSize)
+{
+    // the prefix is hashed as the block starts, so matches may reach back into it.
+    void* ctx = LZ4HC_Create((const BYTE*)source - prefixSize);
+    int result = LZ4_compressHCCtx(ctx, source, dest, isize);
+    LZ4HC_Free (&ctx);
+
+    return result;
+}
+
+
@@ -50,6 +50,15 @@ LZ4_compressHC :
 */
 
 
+int LZ4_compressHC_usingPrefix (const char* source, char* dest, int isize, int prefixSize);
+
+/*
+LZ4_compressHC_usingPrefix :
+	As LZ4_compressHC, but matches may reference the 'prefixSize' bytes before 'source'. ( up to 64KB back )
+	Decompress with LZ4_decompress_fast_usingDict(), giving the same prefix as the dictionary.
+*/
+
+
 /* Note :
 Decompression functions are provided within regular LZ4 source code (see "lz4.h") (BSD license)
 */